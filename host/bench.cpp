@@ -0,0 +1,353 @@
+/**************************************************************
+ * bench.cpp
+ * IECprinter throughput benchmark on the simulated IEC bus
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+/**************************************************************
+ * The sketch runs unchanged against the simulator: setup() once,
+ * then each sample file is sent by the simulated host as one job
+ * (job header, file, end of job marker) at the link speed while
+ * loop() prints it on simulated MPS-803 printers.
+ *
+ * usage: bench [-b baud] [-d devices] [-s start] [-t timing] [-v] files...
+ *   -b baud    : host link speed, default 115200
+ *   -d devices : printer addresses, default 4. "4,5" for two printers
+ *   -s start   : print start policy, idle (default), line, queued or now
+ *   -t timing  : printer response times, key=value list of
+ *                atn, rfd, sample, accept, eoi [us], cps, feed [ms]
+ *   -v         : show interface messages
+ *
+ * Files ending in .ascii are sent as ASCII jobs, others as escaped
+ * PETSCII jobs.
+ * Reported per file:
+ *   in     : file bytes
+ *   wire   : data bytes accepted by printers
+ *   atn    : bus command bytes
+ *   job ms : from first byte sent to end of job
+ *   bus ms : from printer LISTEN to end of job
+ *   B/s    : file bytes per second of bus time
+ *   driver : kcycles spent in IEC driver calls by the main loop, bus waits included
+ *   isr    : kcycles spent in interrupts
+ * and in total the share of job time the CPU sleeps waiting for interrupts.
+ * Exit status is 1 on framing errors, lost host bytes or a job that
+ * did not end.
+ **************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "sim.h"
+#include "mps803.h"
+#include "sketch.cpp"
+
+// Main loop pass overhead charged besides the IecHal and time calls [cycles]
+static const uint32_t CYCLES_LOOP = 400;
+// Simulated time limit per file [s]
+static const uint64_t FILE_LIMIT = 600;
+
+/// Benchmark results
+struct Result {
+  uint32_t in;
+  uint32_t wire;
+  uint32_t atn;
+  uint64_t job;     // [cycles]
+  uint64_t bus;     // [cycles]
+  uint64_t driver;  // [cycles]
+  uint64_t isr;     // [cycles]
+  uint64_t irqs;
+  uint64_t sleep;   // [cycles]
+  uint32_t lines;
+  uint32_t errors;
+  uint64_t host;    // [us]
+  bool ended;       // Job ended within FILE_LIMIT
+};
+
+static std::vector<Mps803*> printers;
+static bool verbose = false;
+
+/// Print and clear interface messages
+static void Messages() {
+  if (verbose && !Sim::Output().empty()) {
+    fputs(Sim::Output().c_str(), stdout);
+  }
+  Sim::Output().clear();
+}
+
+/// Run one main loop pass
+static void Pass() {
+  loop();
+  Sim::Run(CYCLES_LOOP);
+}
+
+/// @return true while a printer is printing a line
+static bool isPrinting() {
+  for (size_t i = 0; i < printers.size(); i++) {
+    if (printers[i]->isBusy()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Print a file as a job and measure it
+/// @param name is the file path
+/// @param baudrate is the host link speed
+/// @param result returns the measures
+/// @return false if file not found
+static bool Bench(const char* name, unsigned long baudrate, Result& result) {
+  FILE* f = fopen(name, "rb");
+  if (!f) {
+    fprintf(stderr, "bench: can not open %s\n", name);
+    return false;
+  }
+  size_t length = strlen(name);
+  bool ascii = (length > 6 && strcmp(name + length - 6, ".ascii") == 0);
+  std::vector<uint8_t> job;
+  job.push_back(JOB_START);
+  job.push_back(printers[0]->Address());
+  job.push_back(ascii ? SAD_BUSINESS : SAD_GRAPH);
+  job.push_back(ascii ? JOB_ASCII : JOB_ESCAPED);
+  if (printers.size() > 1) {
+    job[3] |= JOB_MIRROR;
+  }
+  result.in = 0;
+  int c;
+  while ((c = fgetc(f)) != EOF) {
+    if (!ascii && (c == JOB_END || c == JOB_START || c == JOB_ESCAPE)) {
+      job.push_back(JOB_ESCAPE);
+    }
+    job.push_back(c);
+    result.in++;
+  }
+  fclose(f);
+  job.push_back(JOB_END);
+
+  for (size_t i = 0; i < printers.size(); i++) {
+    printers[i]->ClearCounters();
+  }
+  Sim::Counters start = Sim::Count();
+  uint64_t t0 = Sim::Now();
+  auto host0 = std::chrono::steady_clock::now();
+
+  // Send and print
+  Sim::Feed(&job[0], job.size(), baudrate);
+  result.ended = true;
+  for (;;) {
+    Pass();
+    // Job ends with EOI and the session closes on the end of job marker
+    if (!session && !Sim::isFeeding() && InAvailable() == 0 && printers[0]->Eois() > 0) {
+      break;
+    }
+    if (Sim::Now() - t0 > Sim::Us(1000000ULL * FILE_LIMIT)) {
+      fprintf(stderr, "bench: %s did not end\n", name);
+      result.ended = false;
+      break;
+    }
+  }
+  uint64_t end = Sim::Now();
+  auto host1 = std::chrono::steady_clock::now();
+
+  result.wire = 0;
+  result.errors = 0;
+  result.lines = 0;
+  for (size_t i = 0; i < printers.size(); i++) {
+    result.wire += printers[i]->Bytes();
+    result.errors += printers[i]->Errors();
+    result.lines += printers[i]->Printed();
+  }
+  result.atn = printers[0]->Commands();
+  result.job = end - t0;
+  uint64_t open = printers[0]->Listened();
+  result.bus = (open < end) ? end - open : 0;
+  result.driver = Sim::Count().driver - start.driver;
+  result.isr = Sim::Count().isr - start.isr;
+  result.irqs = Sim::Count().irqs - start.irqs;
+  result.sleep = Sim::Count().sleep - start.sleep;
+  result.host = std::chrono::duration_cast<std::chrono::microseconds>(host1 - host0).count();
+
+  // Let printers finish, next file starts on an idle bus
+  while (result.ended && isPrinting()) {
+    Pass();
+  }
+  Messages();
+  return true;
+}
+
+/// Print a result line
+static void Report(const char* name, const Result& r) {
+  unsigned long ms = r.bus / Sim::Us(1000);
+  printf("%-24s %6u %6u %5u %9llu %9lu %7lu %9llu %8llu %7llu %5u\n", name,
+         r.in, r.wire, r.atn,
+         (unsigned long long)(r.job / Sim::Us(1000)), ms,
+         ms ? (unsigned long)(1000ULL * r.in / ms) : 0UL,
+         (unsigned long long)(r.driver / 1000), (unsigned long long)(r.isr / 1000),
+         (unsigned long long)r.irqs, r.lines);
+}
+
+/// Parse printer response times
+/// @param arg is a key=value list, comma separated
+/// @return false on unknown key
+static bool ParseTiming(char* arg, Mps803Timing& timing) {
+  for (char* item = strtok(arg, ","); item; item = strtok(0, ",")) {
+    char* value = strchr(item, '=');
+    if (!value) {
+      return false;
+    }
+    *value++ = '\0';
+    unsigned int v = strtoul(value, 0, 10);
+    if (strcmp(item, "atn") == 0) {
+      timing.atn = v;
+    } else if (strcmp(item, "rfd") == 0) {
+      timing.rfd = v;
+    } else if (strcmp(item, "sample") == 0) {
+      timing.sample = v;
+    } else if (strcmp(item, "accept") == 0) {
+      timing.accept = v;
+    } else if (strcmp(item, "eoi") == 0) {
+      timing.eoi = v;
+    } else if (strcmp(item, "cps") == 0) {
+      timing.cps = v;
+    } else if (strcmp(item, "feed") == 0) {
+      timing.feed = v;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Parse a print start policy name
+/// @param arg is idle, line, queued or now
+/// @return false on unknown name
+static bool ParseStart(const char* arg, uint8_t& start) {
+  static const char* names[] = { "idle", "line", "queued", "now" };
+  for (uint8_t i = START_IDLE; i <= START_NOW; i++) {
+    if (strcmp(arg, names[i]) == 0) {
+      start = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void Usage() {
+  fprintf(stderr, "usage: bench [-b baud] [-d devices] [-s start] [-t timing] [-v] files...\n"
+                  "  start: idle, line, queued or now\n"
+                  "  timing: atn,rfd,sample,accept,eoi [us], cps, feed [ms] as key=value,...\n");
+  exit(2);
+}
+
+int main(int argc, char* argv[]) {
+  unsigned long baudrate = 115200;
+  std::vector<uint8_t> addresses;
+  Mps803Timing timing = Mps803::TimingDefault;
+  uint8_t start = START_POLICY;
+  int i;
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    const char* opt = argv[i];
+    if (strcmp(opt, "-v") == 0) {
+      verbose = true;
+    } else if (i + 1 < argc && strcmp(opt, "-b") == 0) {
+      baudrate = strtoul(argv[++i], 0, 10);
+    } else if (i + 1 < argc && strcmp(opt, "-d") == 0) {
+      for (char* d = strtok(argv[++i], ","); d; d = strtok(0, ",")) {
+        addresses.push_back(atoi(d));
+      }
+    } else if (i + 1 < argc && strcmp(opt, "-s") == 0) {
+      if (!ParseStart(argv[++i], start)) {
+        Usage();
+      }
+    } else if (i + 1 < argc && strcmp(opt, "-t") == 0) {
+      if (!ParseTiming(argv[++i], timing)) {
+        Usage();
+      }
+    } else {
+      Usage();
+    }
+  }
+  if (i == argc || baudrate == 0) {
+    Usage();
+  }
+  if (addresses.empty()) {
+    addresses.push_back(PAD);
+  }
+  if (addresses.size() > 2 || (addresses.size() == 2 && addresses[1] != PAD_ALT)) {
+    fprintf(stderr, "bench: two printers must be %u,%u (mirror mode)\n", PAD, PAD_ALT);
+    return 2;
+  }
+
+  Sim::Pins pins = { _BV(IEC_SRQ), _BV(IEC_ATN), _BV(IEC_CLK), _BV(IEC_DIO), _BV(IEC_RST) };
+  Sim::Begin(pins);
+  Sim::SetPin(SW_XON, LOW);  // host follows XON/XOFF
+  for (size_t d = 0; d < addresses.size(); d++) {
+    printers.push_back(new Mps803(addresses[d], timing));
+    Sim::Attach(printers.back());
+  }
+
+  // Startup, auto-baud times out
+  setup();
+  usb.Begin(baudrate);
+  settings.start = start;
+  Messages();
+
+  printf("%-24s %6s %6s %5s %9s %9s %7s %9s %8s %7s %5s\n", "file",
+         "in", "wire", "atn", "job ms", "bus ms", "B/s", "driver kc", "isr kc", "irqs", "lines");
+  Result total = {};
+  uint32_t errors = 0;
+  bool ok = true;
+  for (; i < argc; i++) {
+    Result r;
+    if (!Bench(argv[i], baudrate, r)) {
+      ok = false;
+      continue;
+    }
+    const char* name = strrchr(argv[i], '/');
+    Report(name ? name + 1 : argv[i], r);
+    total.in += r.in;
+    total.wire += r.wire;
+    total.atn += r.atn;
+    total.job += r.job;
+    total.bus += r.bus;
+    total.driver += r.driver;
+    total.isr += r.isr;
+    total.irqs += r.irqs;
+    total.sleep += r.sleep;
+    total.lines += r.lines;
+    total.host += r.host;
+    errors += r.errors;
+    if (!r.ended) {
+      ok = false;
+    }
+  }
+  Report("total", total);
+  printf("host time %llu ms, cpu asleep %u%% of job time, framing errors %u, lost host bytes %u\n",
+         (unsigned long long)(total.host / 1000),
+         total.job ? (unsigned)(100 * total.sleep / total.job) : 0U, errors,
+         (unsigned)(Sim::Count().overruns + usb.Overruns()));
+  if (errors > 0 || Sim::Count().overruns > 0 || usb.Overruns() > 0) {
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
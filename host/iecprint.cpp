@@ -0,0 +1,389 @@
+/**************************************************************
+ * iecprint.cpp
+ * Host tool sending print files to IECprinter in framed mode
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+/**************************************************************
+ * Usage: iecprint [-b baud] [-w window] [-a] [-e] port [file...]
+ *   -b baud   : serial link speed up to 1000000, default 9600
+ *   -a        : set interface speed by auto-baud, sends a break then 'U' 
+ *   -w window : max frames in flight, default 8
+ *   -e        : end each file with the end of job marker (EOT), ASCII mode
+ * Reads stdin when no file is given.
+ *
+ * Frames carry a sequence number and a CRC. The interface acks each
+ * frame with the credit of frames it can still queue. Frames are sent
+ * while credit allows; a NAK or a reply timeout resends every frame
+ * from the first one not acknowledged (go-back-N).
+ * Text messages from the interface are copied to stderr.
+ **************************************************************/
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include "linkspeed.h"
+
+// Framed mode characters and limits, see usbserial.h
+static const uint8_t STX = 0x02;
+static const uint8_t ACK = 0x06;
+static const uint8_t NAK = 0x15;
+static const uint8_t JOB_END = 0x04;
+static const size_t FRAME_PAYLOAD = 64;
+
+static const int CONNECT_TIMEOUT = 10000;  // Wait for sync ack [ms], covers board reset
+static const int REPLY_TIMEOUT = 3000;     // Wait for a reply before resending [ms]
+static const int STALL_TIMEOUT = 120000;   // Give up without progress [ms]
+
+/// Frame waiting for acknowledgement
+struct Frame {
+  uint8_t seq;
+  std::vector<uint8_t> bytes;  // Whole frame as sent
+};
+
+/// CRC-16/CCITT-FALSE byte update, same as avr-libc _crc_xmodem_update()
+/// started with 0xFFFF
+static uint16_t CrcUpdate(uint16_t crc, uint8_t data) {
+  crc ^= (uint16_t)data << 8;
+  for (int i = 0; i < 8; i++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+static uint8_t NextSeq(uint8_t seq) { return (seq == 255) ? 1 : seq + 1; }
+
+/// Build a frame
+static Frame MakeFrame(uint8_t seq, const uint8_t payload[], size_t length) {
+  Frame f;
+  f.seq = seq;
+  f.bytes.push_back(STX);
+  f.bytes.push_back(seq);
+  f.bytes.push_back(length);
+  uint16_t crc = CrcUpdate(CrcUpdate(0xFFFF, seq), length);
+  for (size_t i = 0; i < length; i++) {
+    f.bytes.push_back(payload[i]);
+    crc = CrcUpdate(crc, payload[i]);
+  }
+  f.bytes.push_back(crc >> 8);
+  f.bytes.push_back(crc & 0xFF);
+  return f;
+}
+
+/// Serial link to the interface
+class Link {
+public:
+  Link() : m_fd(-1) {}
+  ~Link() { if (m_fd >= 0) close(m_fd); }
+
+  /// Open and configure port for 8N1, raw
+  bool Open(const char* port, long baud) {
+    m_fd = open(port, O_RDWR | O_NOCTTY);
+    if (m_fd < 0) {
+      return false;
+    }
+    termios tio;
+    if (tcgetattr(m_fd, &tio) != 0) {
+      return false;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~CRTSCTS;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    speed_t speed = Speed(baud);
+    cfsetispeed(&tio, speed ? speed : B9600);
+    cfsetospeed(&tio, speed ? speed : B9600);
+    if (tcsetattr(m_fd, TCSANOW, &tio) != 0) {
+      return false;
+    }
+    return (speed != 0 || SetLinkSpeed(m_fd, baud));  // no B constant
+  }
+
+  /// Send a break and the auto-baud character at current speed
+  bool AutoBaud() {
+    tcsendbreak(m_fd, 0);
+    usleep(100000);
+    std::vector<uint8_t> u(1, 'U');
+    if (!Write(u)) {
+      return false;
+    }
+    tcdrain(m_fd);
+    usleep(100000);
+    return true;
+  }
+
+  bool Write(const std::vector<uint8_t>& bytes) {
+    size_t done = 0;
+    while (done < bytes.size()) {
+      ssize_t n = write(m_fd, &bytes[done], bytes.size() - done);
+      if (n < 0 && errno != EINTR) {
+        return false;
+      }
+      if (n > 0) {
+        done += n;
+      }
+    }
+    return true;
+  }
+
+  /// Wait a reply from interface, copying text messages to stderr
+  /// @return ACK, NAK or 0 on timeout
+  uint8_t Reply(int timeoutMs, uint8_t& seq, uint8_t& credit) {
+    uint8_t c;
+    while (ReadByte(c, timeoutMs)) {
+      if (c == ACK || c == NAK) {
+        if (!ReadByte(seq, timeoutMs) || !ReadByte(credit, timeoutMs)) {
+          return 0;
+        }
+        return c;
+      }
+      fputc(c, stderr);  // interface message
+    }
+    return 0;
+  }
+
+private:
+  bool ReadByte(uint8_t& c, int timeoutMs) {
+    pollfd p = { m_fd, POLLIN, 0 };
+    if (poll(&p, 1, timeoutMs) <= 0) {
+      return false;
+    }
+    return (read(m_fd, &c, 1) == 1);
+  }
+
+  static speed_t Speed(long baud) {
+    switch (baud) {
+      case 9600:   return B9600;
+      case 19200:  return B19200;
+      case 38400:  return B38400;
+      case 57600:  return B57600;
+      case 115200: return B115200;
+      case 230400: return B230400;
+      default:     return 0;
+    }
+  }
+
+  int m_fd;
+};
+
+/// Frames to send with sliding window bookkeeping
+class Sender {
+public:
+  Sender(Link& link, size_t window)
+        : m_link(link), m_window(window), m_next(1), m_sent(0), m_credit(0),
+          m_stalled(0) {}
+
+  /// Start framed mode
+  /// @param autoBaud runs the interface auto-baud before each sync try
+  bool Connect(bool autoBaud) {
+    static const uint8_t none[1] = { 0 };
+    Frame sync = MakeFrame(0, none, 0);
+    for (int tries = 0; tries < CONNECT_TIMEOUT / REPLY_TIMEOUT + 1; tries++) {
+      if (autoBaud && !m_link.AutoBaud()) {
+        return false;
+      }
+      if (!m_link.Write(sync.bytes)) {
+        return false;
+      }
+      uint8_t seq;
+      uint8_t credit;
+      if (m_link.Reply(REPLY_TIMEOUT, seq, credit) == ACK) {
+        m_credit = credit;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// Queue payload bytes, sending full frames as the window allows
+  bool Write(const uint8_t data[], size_t length) {
+    m_pending.insert(m_pending.end(), data, data + length);
+    while (m_pending.size() >= FRAME_PAYLOAD) {
+      if (!Queue(&m_pending[0], FRAME_PAYLOAD)) {
+        return false;
+      }
+      m_pending.erase(m_pending.begin(), m_pending.begin() + FRAME_PAYLOAD);
+    }
+    return true;
+  }
+
+  /// Send remaining data and the end of transfer frame, wait all acks
+  bool Finish() {
+    if (!m_pending.empty() && !Queue(&m_pending[0], m_pending.size())) {
+      return false;
+    }
+    m_pending.clear();
+    static const uint8_t none[1] = { 0 };
+    if (!Queue(none, 0, true)) {
+      return false;
+    }
+    while (!m_frames.empty()) {
+      if (!Pump()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  /// Add a frame to the window
+  /// @param last ends the transfer, must be the only frame without payload
+  bool Queue(const uint8_t payload[], size_t length, bool last = false) {
+    if (length == 0 && !last) {
+      return true;
+    }
+    m_frames.push_back(MakeFrame(m_next, payload, length));
+    m_next = NextSeq(m_next);
+    while (m_frames.size() > m_window) {
+      if (!Pump()) {
+        return false;
+      }
+    }
+    return SendAllowed();
+  }
+
+  /// Send frames not yet sent that the credit allows
+  bool SendAllowed() {
+    while (m_sent < m_frames.size() && m_sent < m_credit) {
+      if (!m_link.Write(m_frames[m_sent].bytes)) {
+        return false;
+      }
+      m_sent++;
+    }
+    return true;
+  }
+
+  /// Handle one reply or timeout
+  bool Pump() {
+    if (!SendAllowed()) {
+      return false;
+    }
+    uint8_t seq;
+    uint8_t credit;
+    uint8_t reply = m_link.Reply(REPLY_TIMEOUT, seq, credit);
+    if (reply == 0) {
+      m_stalled += REPLY_TIMEOUT;
+      if (m_stalled >= STALL_TIMEOUT) {
+        fprintf(stderr, "iecprint: no progress, giving up\n");
+        return false;
+      }
+      m_sent = 0;  // resend window
+      return true;
+    }
+    m_credit = credit;
+    if (reply == ACK) {
+      // Drop frames up to the acknowledged one
+      for (size_t i = 0; i < m_frames.size(); i++) {
+        if (m_frames[i].seq == seq) {
+          m_frames.erase(m_frames.begin(), m_frames.begin() + i + 1);
+          m_sent = (m_sent > i + 1) ? m_sent - (i + 1) : 0;
+          m_stalled = 0;
+          break;
+        }
+      }
+    } else {
+      // Resend from the frame the interface expects
+      m_sent = 0;
+      while (!m_frames.empty() && m_frames.front().seq != seq) {
+        m_frames.pop_front();  // already queued by interface
+      }
+    }
+    return true;
+  }
+
+  Link& m_link;
+  size_t m_window;               // Max frames in flight
+  uint8_t m_next;                // Next sequence number
+  std::deque<Frame> m_frames;    // Frames not acknowledged
+  size_t m_sent;                 // Frames of m_frames already sent
+  size_t m_credit;               // Frames interface can queue after last ack
+  int m_stalled;                 // Time without progress [ms]
+  std::vector<uint8_t> m_pending;  // Payload not yet framed
+};
+
+static void Usage() {
+  fprintf(stderr, "usage: iecprint [-b baud] [-w window] [-a] [-e] port [file...]\n");
+  exit(2);
+}
+
+int main(int argc, char* argv[]) {
+  long baud = 9600;
+  size_t window = 8;
+  bool jobEnd = false;
+  bool autoBaud = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:w:ae")) != -1) {
+    switch (opt) {
+      case 'b': baud = atol(optarg); break;
+      case 'w': window = atoi(optarg); break;
+      case 'a': autoBaud = true; break;
+      case 'e': jobEnd = true; break;
+      default: Usage();
+    }
+  }
+  if (optind >= argc || window == 0) {
+    Usage();
+  }
+  Link link;
+  if (!link.Open(argv[optind], baud)) {
+    fprintf(stderr, "iecprint: %s: %s\n", argv[optind], strerror(errno));
+    return 1;
+  }
+  Sender sender(link, window);
+  if (!sender.Connect(autoBaud)) {
+    fprintf(stderr, "iecprint: interface not responding\n");
+    return 1;
+  }
+  std::vector<const char*> files(argv + optind + 1, argv + argc);
+  if (files.empty()) {
+    files.push_back("-");
+  }
+  for (const char* name : files) {
+    FILE* f = strcmp(name, "-") ? fopen(name, "rb") : stdin;
+    if (!f) {
+      fprintf(stderr, "iecprint: %s: %s\n", name, strerror(errno));
+      return 1;
+    }
+    uint8_t buf[1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+      if (!sender.Write(buf, n)) {
+        return 1;
+      }
+    }
+    if (f != stdin) {
+      fclose(f);
+    }
+    if (jobEnd && !sender.Write(&JOB_END, 1)) {
+      return 1;
+    }
+  }
+  return sender.Finish() ? 0 : 1;
+}
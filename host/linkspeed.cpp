@@ -0,0 +1,63 @@
+/**************************************************************
+ * linkspeed.cpp
+ * Serial link speeds without a termios speed constant
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+
+// Kept apart from iecprint.cpp: <asm/termbits.h> clashes with <termios.h>
+#include "linkspeed.h"
+#include <cerrno>
+#include <sys/ioctl.h>
+
+#if defined(__linux__)
+#include <asm/termbits.h>
+
+bool SetLinkSpeed(int fd, long baud) {
+  struct termios2 tio;
+  if (ioctl(fd, TCGETS2, &tio) != 0) {
+    return false;
+  }
+  tio.c_cflag &= ~CBAUD;
+  tio.c_cflag |= BOTHER;
+  tio.c_cflag &= ~(CBAUD << IBSHIFT);
+  tio.c_cflag |= BOTHER << IBSHIFT;
+  tio.c_ispeed = baud;
+  tio.c_ospeed = baud;
+  return (ioctl(fd, TCSETS2, &tio) == 0);
+}
+
+#elif defined(__APPLE__)
+#include <IOKit/serial/ioss.h>
+
+bool SetLinkSpeed(int fd, long baud) {
+  speed_t speed = baud;
+  return (ioctl(fd, IOSSIOSPEED, &speed) == 0);
+}
+
+#else
+
+bool SetLinkSpeed(int, long) {
+  errno = EINVAL;
+  return false;
+}
+
+#endif
@@ -0,0 +1,32 @@
+/**************************************************************
+ * linkspeed.h
+ * Serial link speeds without a termios speed constant
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+/// Set both speeds of an open serial port to any rate the driver supports.
+/// Used for rates with no B constant, like 250000 bauds: termios2 with
+/// BOTHER on Linux, IOSSIOSPEED on macOS.
+/// Call after tcsetattr(), which resets the speed.
+/// @return false with errno set on failure, EINVAL when not supported
+bool SetLinkSpeed(int fd, long baud);
@@ -0,0 +1,132 @@
+/**************************************************************
+ * Arduino.h
+ * Host build of the Arduino core subset used by IECprinter
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL  // Arduino Uno/Nano clock
+#endif
+
+#define HIGH 1
+#define LOW  0
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+
+// Uno/Nano pin numbers
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define LED_BUILTIN 13
+#define NUM_PINS 20
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#define bit(b) (1UL << (b))
+
+#define noInterrupts() cli()
+#define interrupts() sei()
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+// Time runs on the simulated clock (sim.cpp)
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// Digital pins, with the simulated switch settings and outputs
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+/// Flash strings are plain strings on the host
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+/// Text output of the Arduino core
+class Print {
+public:
+  virtual ~Print() {};
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+      n += write(*buffer++);
+    }
+    return n;
+  };
+  size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); };
+
+  size_t print(const __FlashStringHelper* s) { return write((const char*)s); };
+  size_t print(const char* s) { return write(s); };
+  size_t print(char c) { return write((uint8_t)c); };
+  size_t print(unsigned char n, int base = DEC) { return printNumber(n, base); };
+  size_t print(int n, int base = DEC) { return printSigned(n, base); };
+  size_t print(unsigned int n, int base = DEC) { return printNumber(n, base); };
+  size_t print(long n, int base = DEC) { return printSigned(n, base); };
+  size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); };
+
+  size_t println() { return write("\r\n"); };
+  template<class T> size_t println(T value) { size_t n = print(value); return n + println(); };
+  template<class T> size_t println(T value, int base) { size_t n = print(value, base); return n + println(); };
+
+private:
+  size_t printSigned(long n, int base) {
+    if (n < 0 && base == DEC) {
+      return print('-') + printNumber(-(unsigned long)n, base);
+    }
+    return printNumber((unsigned long)n, base);
+  };
+  size_t printNumber(unsigned long n, int base) {
+    char buf[8 * sizeof(long) + 1];
+    char* str = &buf[sizeof(buf) - 1];
+    *str = '\0';
+    do {
+      unsigned long digit = n % base;
+      n /= base;
+      *--str = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    } while (n);
+    return write(str);
+  };
+};
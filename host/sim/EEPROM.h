@@ -0,0 +1,38 @@
+/**************************************************************
+ * EEPROM.h
+ * Host build of the Arduino EEPROM library, erased at start
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ **************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/// ATmega328P 1K bytes EEPROM
+class EEPROMClass {
+public:
+  EEPROMClass() { memset(m_data, 0xFF, sizeof(m_data)); };
+
+  uint8_t read(int address) { return m_data[address]; };
+  void write(int address, uint8_t value) { m_data[address] = value; };
+  void update(int address, uint8_t value) { m_data[address] = value; };
+  uint16_t length() { return sizeof(m_data); };
+
+  template<class T> T& get(int address, T& value) {
+    memcpy(&value, &m_data[address], sizeof(T));
+    return value;
+  };
+  template<class T> const T& put(int address, const T& value) {
+    memcpy(&m_data[address], &value, sizeof(T));
+    return value;
+  };
+
+private:
+  uint8_t m_data[1024];
+};
+
+static EEPROMClass EEPROM;
@@ -0,0 +1,35 @@
+/**************************************************************
+ * SD.h
+ * Host build: declarations only, no spool storage is simulated
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ **************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define O_READ  0x01
+#define O_WRITE 0x02
+#define O_CREAT 0x10
+#define FILE_WRITE (O_READ | O_WRITE | O_CREAT)
+
+struct File {
+  operator bool() { return false; };
+  size_t write(const uint8_t*, size_t);
+  int read(void*, uint16_t);
+  bool seek(uint32_t);
+  uint32_t size();
+  void flush();
+  void close();
+};
+
+struct SDClass {
+  bool begin(uint8_t);
+  bool remove(const char*);
+  File open(const char*, uint8_t mode = O_READ);
+};
+extern SDClass SD;
@@ -0,0 +1,29 @@
+/**************************************************************
+ * SPI.h
+ * Host build: declarations only, no spool storage is simulated
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ **************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MSBFIRST  1
+#define SPI_MODE0 0
+
+struct SPISettings {
+  SPISettings(uint32_t, uint8_t, uint8_t) {};
+};
+
+struct SPIClass {
+  void begin();
+  void beginTransaction(SPISettings);
+  void endTransaction();
+  uint8_t transfer(uint8_t);
+  void transfer(void*, size_t);
+};
+extern SPIClass SPI;
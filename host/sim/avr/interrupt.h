@@ -0,0 +1,23 @@
+/**************************************************************
+ * avr/interrupt.h
+ * Host build: interrupt vectors are called by the simulator
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ **************************************************************/
+
+#pragma once
+
+#include <avr/io.h>
+
+// A vector is a plain function, called by the simulator while the
+// global interrupt flag is set
+#define ISR(vector, ...) extern "C" void vector(void)
+
+extern "C" void TIMER1_COMPA_vect(void);
+extern "C" void PCINT2_vect(void);
+extern "C" void USART_RX_vect(void);
+
+void cli();
+void sei();
@@ -0,0 +1,82 @@
+/**************************************************************
+ * avr/io.h
+ * Host build of the ATmega328P registers used by IECprinter
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ **************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+/**************************************************************
+ * IEC lines, Timer1 compare A and pin change interrupts are reached
+ * through IecHal (iechost.h) and simulated there. The registers here
+ * serve the remaining code: plain memory, except USART0 status and
+ * data registers that talk to the simulated host link.
+ **************************************************************/
+
+#define _BV(b) (1 << (b))
+#define bit_is_set(reg, b) ((reg) & _BV(b))
+#define bit_is_clear(reg, b) (!((reg) & _BV(b)))
+
+extern volatile uint8_t SREG;
+extern volatile uint8_t MCUSR;
+extern volatile uint8_t PORTD, DDRD, PIND;
+extern volatile uint8_t TCCR1A, TCCR1B, TIFR1, TIMSK1;
+extern volatile uint16_t TCNT1, OCR1A;
+extern volatile uint8_t PCICR, PCMSK2, PCIFR;
+extern volatile uint8_t UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+
+/// USART0 status: always ready to transmit, receive flags from the host link
+struct SimUcsr0a {
+  operator uint8_t() const;
+  SimUcsr0a& operator=(uint8_t value);
+};
+extern SimUcsr0a UCSR0A;
+
+/// USART0 data: writes go to the host, reads take the received byte
+struct SimUdr0 {
+  operator uint8_t() const;
+  SimUdr0& operator=(uint8_t value);
+};
+extern SimUdr0 UDR0;
+
+// SREG
+#define SREG_I 7
+// MCUSR
+#define PORF  0
+#define EXTRF 1
+#define BORF  2
+#define WDRF  3
+// Port D
+#define PD0 0
+// UCSR0A
+#define RXC0  7
+#define TXC0  6
+#define UDRE0 5
+#define FE0   4
+#define DOR0  3
+#define UPE0  2
+#define U2X0  1
+// UCSR0B
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0  4
+#define TXEN0  3
+// UCSR0C
+#define UCSZ01 2
+#define UCSZ00 1
+// Timer1
+#define CS10   0
+#define CS11   1
+#define CS12   2
+#define OCIE1A 1
+#define OCF1A  1
+#define TOV1   0
+// Pin change interrupts
+#define PCIE2 2
+#define PCIF2 2
@@ -0,0 +1,20 @@
+/**************************************************************
+ * avr/wdt.h
+ * Host build: the watchdog never expires
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ **************************************************************/
+
+#pragma once
+
+#define WDTO_1S 6
+#define WDTO_2S 7
+#define WDTO_4S 8
+#define WDTO_8S 9
+
+inline void wdt_enable(uint8_t) {}
+inline void wdt_disable() {}
+// Busy waits feed the watchdog, so it also runs the simulated clock
+void wdt_reset();
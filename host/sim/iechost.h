@@ -0,0 +1,68 @@
+/**************************************************************
+ * iechost.h
+ * IEC bus hardware access layer, host build
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+/**************************************************************
+ * Same interface as the target IecHal in iechal.h, implemented by
+ * the simulator (sim.cpp). Each call charges the cycles the target
+ * code takes and runs the simulated bus and interrupts meanwhile.
+ **************************************************************/
+
+namespace IecHal {
+  // Simulated Timer1 at clk/8 of a 16 MHz target
+  constexpr unsigned int TICKS_PER_US = 2;
+  constexpr bool BIT_CLOCK = false;
+
+  inline void Begin(uint8_t) {}
+  void Assert(uint8_t pins);
+  void Release(uint8_t pins);
+  uint8_t Lines();
+
+  unsigned long Micros();
+  void DelayMicros(unsigned int us);
+  void DelayLoop(uint16_t loops);
+  void Delay(unsigned long ms);
+  void Sleep();
+  void Spin();
+  // Instantaneous condition test, as with interrupts off on AVR
+  template<class Busy> inline void Sleep(Busy busy) { if (busy()) Sleep(); }
+  template<class Busy> inline void Spin(Busy busy) { if (busy()) Spin(); }
+
+  void TimerBegin();
+  uint16_t TimerCount();
+  void TimerAlarm(uint16_t at);
+  void TimerAlarmOff();
+
+  void PinWatch(uint8_t pins);
+  void PinWatchOff();
+  bool isPinWatched();
+
+  inline void BitClock(uint8_t, uint8_t, uint8_t, uint8_t, uint8_t) {}
+}
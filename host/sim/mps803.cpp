@@ -0,0 +1,294 @@
+/**************************************************************
+ * mps803.cpp
+ * Simulated IEC bus printer, MPS-803 timing model
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#include "mps803.h"
+
+// Printer control codes
+static const uint8_t CODE_LF           = 0x0A;
+static const uint8_t CODE_CR           = 0x0D;
+static const uint8_t CODE_CR_SHIFT     = 0x8D;
+static const uint8_t CODE_IMAGE_BEGIN  = 0x08;
+static const uint8_t CODE_IMAGE_END    = 0x0F;
+static const uint8_t CODE_POSITION     = 0x10;
+static const uint8_t CODE_IMAGE_REPEAT = 0x1A;
+static const uint8_t CODE_ESCAPE       = 0x1B;
+
+/// Typical MPS-803 response times
+const Mps803Timing Mps803::TimingDefault = {
+  80,   // atn
+  60,   // rfd
+  12,   // sample
+  40,   // accept
+  60,   // eoi
+  60,   // cps
+  100   // feed
+};
+
+/// Constructor
+/// @param device is the device address
+/// @param timing are the device response times
+Mps803::Mps803(uint8_t device, const Mps803Timing& timing)
+          : m_device(device), m_timing(timing), m_level(Sim::Lines()) {
+  Reset();
+  ClearCounters();
+}
+
+/// Power on state
+void Mps803::Reset() {
+  Sim::Drive(this, 0);
+  Enter(IDLE);
+  m_atn = false;
+  m_listening = false;
+  m_eoi = false;
+  m_image = false;
+  m_args = 0;
+  m_repeat = false;
+  m_escape = false;
+  m_repeatCount = 0;
+  m_dots = 0;
+  m_busyUntil = 0;
+}
+
+/// Clear reception counters
+void Mps803::ClearCounters() {
+  m_bytes = 0;
+  m_commands = 0;
+  m_eois = 0;
+  m_printed = 0;
+  m_errors = 0;
+  m_listened = Sim::NEVER;
+  m_first = Sim::NEVER;
+  m_last = 0;
+}
+
+/// Go to a protocol state
+/// @param state is the new state
+/// @param wake is the cycle of the state timed action
+void Mps803::Enter(uint8_t state, uint64_t wake) {
+  m_state = state;
+  this->wake = wake;
+}
+
+/// Bus line change
+void Mps803::Change(uint8_t lines) {
+  const Sim::Pins& iec = Sim::Iec();
+  uint8_t asserted = m_level & ~lines;
+  uint8_t released = ~m_level & lines;
+  m_level = lines;
+
+  if (asserted & iec.rst) {
+    Reset();
+    return;
+  }
+  if (asserted & iec.atn) {
+    // Every device answers ATN
+    m_atn = true;
+    Enter(ATN_ACK, Sim::Now() + Sim::Us(m_timing.atn));
+    return;
+  }
+  if (released & iec.atn) {
+    m_atn = false;
+    if (m_listening) {
+      Sim::Drive(this, iec.dio);  // Not ready until talker sends
+      Enter(WAIT_RTS);
+      if (!isAsserted(iec.clk)) {
+        StartReady();
+      }
+    } else {
+      Sim::Drive(this, 0);
+      Enter(IDLE);
+    }
+    return;
+  }
+
+  if (released & iec.clk) {
+    if (m_state == WAIT_RTS) {
+      StartReady();  // Talker Ready to Send
+    } else if (m_state == BITS) {
+      Enter(SAMPLE, Sim::Now() + Sim::Us(m_timing.sample));  // Bit valid
+    }
+  }
+  if (asserted & iec.clk) {
+    if (m_state == READY || m_state == EOI_DONE) {
+      Enter(BITS);  // Talker preparing first bit
+    } else if (m_state == SAMPLE) {
+      // Bit gone before it was read
+      m_errors++;
+      Sim::Drive(this, 0);
+      Enter(LOST);
+    } else if (m_state == FRAME) {
+      Enter(ACCEPT, Sim::Now() + Sim::Us(m_timing.accept));
+    }
+  }
+}
+
+/// Timed action of current state
+void Mps803::Wake() {
+  const Sim::Pins& iec = Sim::Iec();
+  switch (m_state) {
+    case ATN_ACK:
+      Sim::Drive(this, iec.dio);  // Device present
+      Enter(WAIT_RTS);
+      if (!isAsserted(iec.clk)) {
+        StartReady();
+      }
+      break;
+    case RFD_DELAY:
+      Sim::Drive(this, 0);  // Ready for Data
+      Enter(READY, Sim::Now() + Sim::Us(TIME_EOI_DETECT));
+      break;
+    case READY:
+      // Talker silent: EOI, acknowledged with a DIO pulse
+      m_eoi = true;
+      Sim::Drive(this, iec.dio);
+      Enter(EOI_ACK, Sim::Now() + Sim::Us(m_timing.eoi));
+      break;
+    case EOI_ACK:
+      Sim::Drive(this, 0);
+      Enter(EOI_DONE);
+      break;
+    case SAMPLE:
+      Sample();
+      break;
+    case ACCEPT:
+      Sim::Drive(this, iec.dio);  // Data Accepted
+      Byte(m_data);
+      Enter(WAIT_RTS);
+      if (!isAsserted(iec.clk)) {
+        StartReady();
+      }
+      break;
+  }
+}
+
+/// Talker Ready to Send: schedule Ready for Data, held off while printing
+void Mps803::StartReady() {
+  m_data = 0;
+  m_bit = 0;
+  uint64_t at = Sim::Now() + Sim::Us(m_timing.rfd);
+  if (!m_atn && m_busyUntil > at) {
+    at = m_busyUntil;
+  }
+  Enter(RFD_DELAY, at);
+}
+
+/// Read a bit on DIO, LSB first
+void Mps803::Sample() {
+  m_data >>= 1;
+  if (!isAsserted(Sim::Iec().dio)) {
+    m_data |= 0x80;  // DIO released: bit=1
+  }
+  m_bit++;
+  Enter((m_bit < 8) ? BITS : FRAME);
+}
+
+/// Accepted byte
+void Mps803::Byte(uint8_t data) {
+  if (m_atn) {
+    m_commands++;
+    Command(data);
+  } else if (m_listening) {
+    m_bytes++;
+    if (m_eoi) {
+      m_eois++;
+    }
+    if (m_first == Sim::NEVER) {
+      m_first = Sim::Now();
+    }
+    m_last = Sim::Now();
+    Print(data);
+  }
+  m_eoi = false;
+}
+
+/// Bus command under ATN
+void Mps803::Command(uint8_t cmd) {
+  uint8_t address = cmd & 0x1F;
+  if ((cmd & 0xE0) == 0x20) {
+    if (address == 0x1F) {
+      m_listening = false;  // UNLISTEN
+    } else if (address == m_device) {
+      m_listening = true;   // LISTEN
+      if (m_listened == Sim::NEVER) {
+        m_listened = Sim::Now();
+      }
+    }
+  }
+}
+
+/// Printer data
+void Mps803::Print(uint8_t c) {
+  if (m_args > 0) {
+    // Command argument
+    m_args--;
+    if (m_repeat && m_args == 1) {
+      m_repeatCount = c;
+    } else if (m_repeat && m_args == 0) {
+      m_repeat = false;
+      m_dots += m_repeatCount;
+    }
+  } else if (m_escape) {
+    m_escape = false;
+    if (c == CODE_POSITION) {
+      m_args = 2;  // dot address
+    }
+  } else if (c == CODE_CR || c == CODE_CR_SHIFT || c == CODE_LF) {
+    m_image = false;
+    PrintLine();
+    return;
+  } else if (c == CODE_IMAGE_BEGIN) {
+    m_image = true;
+  } else if (c == CODE_IMAGE_END) {
+    m_image = false;
+  } else if (c == CODE_IMAGE_REPEAT) {
+    m_repeat = true;
+    m_args = 2;
+  } else if (c == CODE_POSITION) {
+    m_args = 2;  // character position digits
+  } else if (c == CODE_ESCAPE) {
+    m_escape = true;
+  } else if (m_image) {
+    if (c & 0x80) {
+      m_dots++;  // bit image column
+    }
+  } else if ((c >= 0x20 && c < 0x80) || c >= 0xA0) {
+    m_dots += CHAR_DOTS;
+  }
+  if (m_dots >= LINE_DOTS) {
+    PrintLine();
+  }
+}
+
+/// Print the line buffer and feed paper
+void Mps803::PrintLine() {
+  m_printed++;
+  if (m_timing.cps > 0) {
+    uint64_t time = Sim::Us(1000000ULL * m_dots / (CHAR_DOTS * m_timing.cps) +
+                            1000ULL * m_timing.feed);
+    uint64_t start = (m_busyUntil > Sim::Now()) ? m_busyUntil : Sim::Now();
+    m_busyUntil = start + time;
+  }
+  m_dots = 0;
+}
@@ -0,0 +1,141 @@
+/**************************************************************
+ * mps803.h
+ * Simulated IEC bus printer, MPS-803 timing model
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+#include "sim.h"
+
+/**************************************************************
+ * A listen only device with the standard IEC protocol:
+ *   ATN     : asserts DIO after the ATN response time and takes
+ *             command bytes, LISTEN and UNLISTEN select it.
+ *   Bytes   : releases DIO (Ready for Data) after the RFD time from
+ *             talker Ready to Send, acknowledges EOI when CLK stays
+ *             released for 200us, samples each bit a while after CLK
+ *             release and asserts DIO (Data Accepted) after the DA time.
+ *   RST     : back to power on state.
+ * A bit that is no longer valid when sampled is a framing error: the
+ * byte is not accepted and the device ignores the bus until ATN.
+ *
+ * Printer mechanics: a line prints on carriage return or when full
+ * (480 dots, 80 characters of 6 dots or 480 bit image columns), at a
+ * rate in characters per second plus a line feed time. Ready for
+ * Data is held off while printing. The one line buffer is the
+ * reason the MPS-803 is slow to accept the first byte of a line.
+ * TALK is never answered, so status polling sees a listen only printer.
+ **************************************************************/
+
+/// Device response times
+struct Mps803Timing {
+  unsigned int atn;     // ATN response [us]
+  unsigned int rfd;     // Ready for Data after Ready to Send [us]
+  unsigned int sample;  // Bit sample after CLK release [us]
+  unsigned int accept;  // Data Accepted after the last bit [us]
+  unsigned int eoi;     // EOI acknowledge pulse [us]
+  unsigned int cps;     // Print speed [characters/s], 0 for no mechanics
+  unsigned int feed;    // Line feed [ms]
+};
+
+/// Simulated MPS-803 printer
+class Mps803 : public Sim::Device {
+public:
+  static const Mps803Timing TimingDefault;
+
+  Mps803(uint8_t device, const Mps803Timing& timing = TimingDefault);
+
+  virtual void Change(uint8_t lines);
+  virtual void Wake();
+
+  void Reset();
+  bool isBusy() { return Sim::Now() < m_busyUntil; };
+
+  uint8_t Address() { return m_device; };
+  uint32_t Bytes() { return m_bytes; };          // Data bytes accepted
+  uint32_t Commands() { return m_commands; };    // ATN bytes accepted
+  uint32_t Eois() { return m_eois; };            // Bytes received with EOI
+  uint32_t Printed() { return m_printed; };      // Lines printed
+  uint32_t Errors() { return m_errors; };        // Framing errors
+  uint64_t Listened() { return m_listened; };    // Cycle of first LISTEN, NEVER if none
+  uint64_t FirstByte() { return m_first; };      // Cycle of first data byte, NEVER if none
+  uint64_t LastByte() { return m_last; };        // Cycle of last data byte
+  void ClearCounters();
+
+private:
+  // Protocol states
+  static const uint8_t IDLE      = 0;  // Not addressed, lines released
+  static const uint8_t ATN_ACK   = 1;  // ATN seen, DIO assertion due
+  static const uint8_t WAIT_RTS  = 2;  // Waiting talker Ready to Send
+  static const uint8_t RFD_DELAY = 3;  // Ready for Data due
+  static const uint8_t READY     = 4;  // Ready for Data, waiting first bit
+  static const uint8_t EOI_ACK   = 5;  // EOI acknowledge pulse
+  static const uint8_t EOI_DONE  = 6;  // After EOI, waiting first bit
+  static const uint8_t BITS      = 7;  // Waiting bit valid at CLK release
+  static const uint8_t SAMPLE    = 8;  // Bit sample due
+  static const uint8_t FRAME     = 9;  // All bits, waiting talker CLK assertion
+  static const uint8_t ACCEPT    = 10; // Data Accepted due
+  static const uint8_t LOST      = 11; // Framing error, ignoring bus
+
+  static const unsigned int TIME_EOI_DETECT = 200;  // Talker silence for EOI [us]
+  static const unsigned int LINE_DOTS = 480;        // Dots per line
+  static const unsigned int CHAR_DOTS = 6;          // Dots per character
+
+  void Enter(uint8_t state, uint64_t wake = Sim::NEVER);
+  void StartReady();
+  void Sample();
+  void Byte(uint8_t data);
+  void Command(uint8_t cmd);
+  void Print(uint8_t c);
+  void PrintLine();
+  bool isAsserted(uint8_t line) { return !(m_level & line); };
+
+  uint8_t m_device;
+  Mps803Timing m_timing;
+  uint8_t m_state;
+  uint8_t m_level;        // Last seen line levels
+  bool m_atn;             // Under ATN
+  bool m_listening;       // Addressed by LISTEN
+  bool m_eoi;             // EOI signaled for byte in reception
+  uint8_t m_data;         // Byte in reception
+  uint8_t m_bit;          // Bits received
+
+  // Printer mechanics
+  bool m_image;           // Bit image mode
+  uint8_t m_args;         // Command argument bytes to skip
+  bool m_repeat;          // Next argument is a repeat count
+  bool m_escape;          // Escape seen
+  unsigned int m_repeatCount;
+  unsigned int m_dots;    // Dots in line buffer
+  uint64_t m_busyUntil;   // End of current line print [cycles]
+
+  // Counters
+  uint32_t m_bytes;
+  uint32_t m_commands;
+  uint32_t m_eois;
+  uint32_t m_printed;
+  uint32_t m_errors;
+  uint64_t m_listened;
+  uint64_t m_first;
+  uint64_t m_last;
+};
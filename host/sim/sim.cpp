@@ -0,0 +1,493 @@
+/**************************************************************
+ * sim.cpp
+ * IEC bus simulator core: clock, lines, interrupts and host link
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#include <deque>
+#include "sim.h"
+#include <Arduino.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#include "iechost.h"
+
+using namespace Sim;
+
+// Registers kept as plain memory
+volatile uint8_t SREG = _BV(SREG_I);  // Arduino core enables interrupts before setup()
+volatile uint8_t MCUSR = _BV(PORF);
+volatile uint8_t PORTD, DDRD, PIND = 0xFF;
+volatile uint8_t TCCR1A, TCCR1B, TIFR1, TIMSK1;
+volatile uint16_t TCNT1, OCR1A;
+volatile uint8_t PCICR, PCMSK2, PCIFR;
+volatile uint8_t UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+SimUcsr0a UCSR0A;
+SimUdr0 UDR0;
+
+namespace {
+
+static const uint8_t XON  = 0x11;
+static const uint8_t XOFF = 0x13;
+static const uint8_t USART_FIFO = 2;       // USART receive buffer depth
+static const uint64_t TIMER_PERIOD = 65536ULL * 8;  // Timer1 at clk/8 [cycles]
+static const uint64_t TICK_PERIOD = 256ULL * 64;    // Timer0 overflow, millis() tick [cycles]
+
+uint64_t now = 0;
+bool inIsr = false;
+Sim::Counters counters;
+
+// Bus
+Sim::Pins iec;
+static const size_t MAX_DEVICES = 8;
+Sim::Device* devices[MAX_DEVICES];  // Plain array, still valid for destructors at exit
+size_t deviceCount = 0;
+uint8_t controller = 0;  // Lines asserted by the controller
+uint8_t level = 0xFF;    // Line levels, bit set = released
+
+// Timer1 compare A
+bool alarmOn = false;
+bool alarmFlag = false;
+uint64_t nextMatch = Sim::NEVER;
+
+// Pin change
+bool watchOn = false;
+bool watchFlag = false;
+uint8_t watchMask = 0;
+
+// Host link
+std::deque<uint8_t> feed;    // Bytes the host still has to send
+uint64_t byteTime = 0;       // Cycles per byte on the link
+uint64_t nextRx = Sim::NEVER;
+bool xoff = false;           // Host stopped by XOFF
+bool ctsOff = false;         // Host stopped by CTS
+uint8_t ctsPin = 0xFF;
+std::deque<uint8_t> fifo;    // USART receive buffer
+uint8_t ucsr0a = 0;
+std::string output;
+uint8_t pins[NUM_PINS];
+
+void Dispatch();
+void Events();
+
+/// Earliest pending event
+uint64_t NextEvent() {
+  uint64_t next = alarmOn ? nextMatch : Sim::NEVER;
+  for (size_t i = 0; i < deviceCount; i++) {
+    next = min(next, devices[i]->wake);
+  }
+  return min(next, nextRx);
+}
+
+/// Schedule the next host byte
+void Schedule() {
+  if (feed.empty() || xoff || ctsOff || byteTime == 0) {
+    nextRx = Sim::NEVER;
+  } else if (nextRx == Sim::NEVER) {
+    nextRx = now + byteTime;
+  }
+}
+
+/// A byte from host reaches the USART
+void Receive() {
+  uint8_t c = feed.front();
+  feed.pop_front();
+  nextRx = Sim::NEVER;
+  Schedule();
+  if (!(UCSR0B & _BV(RXEN0))) {
+    return;  // receiver off, byte lost
+  }
+  if (fifo.size() >= USART_FIFO) {
+    counters.overruns++;
+    return;
+  }
+  fifo.push_back(c);
+}
+
+/// Recompute wired-AND line levels and tell devices about changes
+void Update() {
+  uint8_t asserted = controller;
+  for (size_t i = 0; i < deviceCount; i++) {
+    asserted |= devices[i]->drive;
+  }
+  uint8_t lines = ~asserted;
+  uint8_t changed = lines ^ level;
+  if (changed == 0) {
+    return;
+  }
+  level = lines;
+  if (changed & watchMask) {
+    watchFlag = true;
+  }
+  for (size_t i = 0; i < deviceCount; i++) {
+    devices[i]->Change(level);
+  }
+}
+
+/// Run events due at current time
+void Events() {
+  while (alarmOn && nextMatch <= now) {
+    alarmFlag = true;
+    nextMatch += TIMER_PERIOD;  // matches again after a full period
+  }
+  bool due = true;
+  while (due) {
+    due = false;
+    for (size_t i = 0; i < deviceCount; i++) {
+      if (devices[i]->wake <= now) {
+        devices[i]->wake = Sim::NEVER;
+        devices[i]->Wake();
+        due = true;
+      }
+    }
+  }
+  while (nextRx <= now) {
+    Receive();
+  }
+}
+
+/// Serve pending interrupts, by vector priority
+void Dispatch() {
+  while (!inIsr && (SREG & _BV(SREG_I))) {
+    void (*vector)(void);
+    if (watchOn && watchFlag) {
+      watchFlag = false;
+      vector = PCINT2_vect;
+    } else if (alarmOn && alarmFlag) {
+      alarmFlag = false;
+      vector = TIMER1_COMPA_vect;
+    } else if ((UCSR0B & _BV(RXCIE0)) && !fifo.empty()) {
+      vector = USART_RX_vect;
+    } else {
+      return;
+    }
+    uint64_t start = now;
+    inIsr = true;
+    SREG &= ~_BV(SREG_I);
+    Sim::Run(CYCLES_IRQ / 2);
+    vector();
+    Sim::Run(CYCLES_IRQ / 2);
+    SREG |= _BV(SREG_I);
+    inIsr = false;
+    counters.isr += now - start;
+    counters.irqs++;
+  }
+}
+
+/// Charge cycles of IEC driver code
+void Cost(uint64_t cycles) {
+  if (!inIsr) {
+    counters.driver += cycles;
+  }
+  Sim::Run(cycles);
+}
+
+}  // namespace
+
+namespace Sim {
+
+/// Start simulation
+/// @param pins are the IEC line bit masks at Port D
+void Begin(const Pins& pins) {
+  iec = pins;
+  memset(::pins, HIGH, sizeof(::pins));  // switches open, pull-ups on
+}
+
+/// Connect a device to the bus
+void Attach(Device* device) {
+  if (deviceCount < MAX_DEVICES) {
+    devices[deviceCount++] = device;
+  }
+  Update();
+}
+
+const Pins& Iec() {
+  return iec;
+}
+
+/// @return simulated time [cycles]
+uint64_t Now() {
+  return now;
+}
+
+/// @return cycles in a time
+/// @param us is the time [us]
+uint64_t Us(uint64_t us) {
+  return us * (F_CPU / 1000000UL);
+}
+
+/// Run the CPU for some cycles. Interrupts served meanwhile add to them.
+/// @param cycles is the number of cycles taken by the running code
+void Run(uint64_t cycles) {
+  uint64_t target = now + cycles;
+  for (;;) {
+    uint64_t start = now;
+    Dispatch();
+    target += now - start;
+    uint64_t next = NextEvent();
+    if (next > target) {
+      break;
+    }
+    if (next > now) {
+      now = next;
+    }
+    Events();
+  }
+  now = target;
+}
+
+/// Set the lines asserted by a device
+void Drive(Device* device, uint8_t lines) {
+  device->drive = lines;
+  Update();
+}
+
+/// @return line levels, a bit set for each released line
+uint8_t Lines() {
+  return level;
+}
+
+/// Queue bytes sent by host at a link speed, 8N1
+void Feed(const uint8_t data[], size_t length, unsigned long baudrate) {
+  byteTime = 10 * F_CPU / baudrate;
+  feed.insert(feed.end(), data, data + length);
+  Schedule();
+}
+
+/// @return true while host bytes are waiting to be sent
+bool isFeeding() {
+  return !feed.empty();
+}
+
+/// Set a digital input, a configuration switch
+void SetPin(uint8_t pin, uint8_t level) {
+  ::pins[pin] = level;
+}
+
+/// Select the CTS output that the host follows
+void SetCtsPin(uint8_t pin) {
+  ctsPin = pin;
+}
+
+/// @return bytes sent to host
+std::string& Output() {
+  return output;
+}
+
+const Counters& Count() {
+  return counters;
+}
+
+}  // namespace Sim
+
+//-----------------------------------------------
+// IecHal
+//-----------------------------------------------
+
+void IecHal::Assert(uint8_t pins) {
+  controller |= pins;
+  Update();
+  Cost(CYCLES_LINE);
+}
+
+void IecHal::Release(uint8_t pins) {
+  controller &= ~pins;
+  Update();
+  Cost(CYCLES_LINE);
+}
+
+uint8_t IecHal::Lines() {
+  uint8_t lines = level;
+  Cost(CYCLES_LINE);
+  return lines;
+}
+
+unsigned long IecHal::Micros() {
+  Cost(CYCLES_MICROS);
+  return now / Sim::Us(1);
+}
+
+void IecHal::DelayMicros(unsigned int us) {
+  Cost(Sim::Us(us));
+}
+
+void IecHal::DelayLoop(uint16_t loops) {
+  Cost(4UL * loops);
+}
+
+void IecHal::Delay(unsigned long ms) {
+  Cost(Sim::Us(1000ULL * ms));
+}
+
+void IecHal::Sleep() {
+  // Until an interrupt is served or the next Timer0 overflow
+  uint64_t tick = (now / TICK_PERIOD + 1) * TICK_PERIOD;
+  uint64_t start = now;
+  uint64_t irqs = counters.irqs;
+  uint64_t isr = counters.isr;
+  while (counters.irqs == irqs && now < tick) {
+    uint64_t next = min(NextEvent(), tick);
+    Sim::Run(next > now ? next - now : 0);
+  }
+  counters.sleep += (now - start) - (counters.isr - isr);
+}
+
+void IecHal::Spin() {
+  Cost(CYCLES_SPIN);
+  IecHal::Sleep();
+}
+
+void IecHal::TimerBegin() {
+  Cost(CYCLES_TIMER);
+}
+
+uint16_t IecHal::TimerCount() {
+  uint16_t count = now / 8;
+  Cost(CYCLES_TIMER);
+  return count;
+}
+
+void IecHal::TimerAlarm(uint16_t at) {
+  uint64_t ticks = now / 8;
+  uint64_t delta = (uint16_t)(at - ticks);
+  if (delta == 0) {
+    delta = 0x10000;  // match blocked right after a write, a full period
+  }
+  nextMatch = (ticks + delta) * 8;
+  alarmFlag = false;
+  alarmOn = true;
+  Cost(CYCLES_ALARM);
+}
+
+void IecHal::TimerAlarmOff() {
+  alarmOn = false;
+  Cost(CYCLES_MASK);
+}
+
+void IecHal::PinWatch(uint8_t pins) {
+  watchMask = pins;
+  watchFlag = false;
+  watchOn = true;
+  Cost(CYCLES_ALARM);
+}
+
+void IecHal::PinWatchOff() {
+  watchOn = false;
+  Cost(CYCLES_MASK);
+}
+
+bool IecHal::isPinWatched() {
+  Cost(CYCLES_MASK);
+  return watchOn;
+}
+
+//-----------------------------------------------
+// Arduino core and avr-libc
+//-----------------------------------------------
+
+unsigned long millis() {
+  Sim::Run(CYCLES_MILLIS);
+  return now / Sim::Us(1000);
+}
+
+unsigned long micros() {
+  Sim::Run(CYCLES_MICROS);
+  return now / Sim::Us(1);
+}
+
+void delay(unsigned long ms) {
+  Sim::Run(Sim::Us(1000ULL * ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+  Sim::Run(Sim::Us(us));
+}
+
+void pinMode(uint8_t, uint8_t) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin >= NUM_PINS) {
+    return;
+  }
+  pins[pin] = value;
+  if (pin == ctsPin) {
+    ctsOff = (value == HIGH);
+    Schedule();
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  return (pin < NUM_PINS) ? pins[pin] : LOW;
+}
+
+void wdt_reset() {
+  Sim::Run(CYCLES_SPIN);
+}
+
+void cli() {
+  SREG &= ~_BV(SREG_I);
+}
+
+void sei() {
+  SREG |= _BV(SREG_I);
+  Sim::Run(0);
+}
+
+void SimRestoreSreg(uint8_t sreg) {
+  SREG = sreg;
+  if (sreg & _BV(SREG_I)) {
+    Sim::Run(0);
+  }
+}
+
+SimUcsr0a::operator uint8_t() const {
+  Sim::Run(CYCLES_UDR);
+  return ucsr0a | _BV(UDRE0) | (fifo.empty() ? 0 : _BV(RXC0));
+}
+
+SimUcsr0a& SimUcsr0a::operator=(uint8_t value) {
+  ucsr0a = value & _BV(U2X0);
+  return *this;
+}
+
+SimUdr0::operator uint8_t() const {
+  Sim::Run(CYCLES_UDR);
+  if (fifo.empty()) {
+    return 0;
+  }
+  uint8_t c = fifo.front();
+  fifo.pop_front();
+  return c;
+}
+
+SimUdr0& SimUdr0::operator=(uint8_t value) {
+  if (value == XOFF) {
+    xoff = true;
+  } else if (value == XON) {
+    xoff = false;
+  } else {
+    output += (char)value;
+  }
+  Schedule();
+  Sim::Run(CYCLES_UDR);
+  return *this;
+}
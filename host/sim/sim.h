@@ -0,0 +1,117 @@
+/**************************************************************
+ * sim.h
+ * IEC bus simulator core: clock, lines, interrupts and host link
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/**************************************************************
+ * The firmware runs natively on the host against a simulated clock
+ * counted in target CPU cycles (16 MHz). Code does not advance the
+ * clock by itself: IecHal calls, Arduino time functions and busy
+ * waits charge the cycles the target takes for them, from a fixed
+ * cost model. While cycles run, the simulator moves bus devices,
+ * Timer1 compare matches and host link bytes forward in time and
+ * calls interrupt vectors when the interrupt flag is set. Interrupt
+ * time stretches the interrupted code, as on the target.
+ *
+ * Bus lines are wired-AND: a line is low when the controller or any
+ * device asserts it.
+ *
+ * Cycle counts come from the cost model, not from instruction
+ * counting: they track changes of bus waits, delays and interrupt
+ * load, not of plain computation.
+ **************************************************************/
+
+namespace Sim {
+
+static const uint64_t NEVER = UINT64_MAX;
+
+/// Cost model, target CPU cycles
+static const uint32_t CYCLES_LINE   = 4;   // Line assert or release, read and test
+static const uint32_t CYCLES_TIMER  = 4;   // Timer1 count read, 16 bit register
+static const uint32_t CYCLES_ALARM  = 12;  // Compare A set: OCR1A, flag clear, mask
+static const uint32_t CYCLES_MASK   = 4;   // Interrupt mask change or test
+static const uint32_t CYCLES_MICROS = 44;  // Arduino micros()
+static const uint32_t CYCLES_MILLIS = 20;  // Arduino millis()
+static const uint32_t CYCLES_SPIN   = 6;   // One pass of a busy wait loop
+static const uint32_t CYCLES_IRQ    = 70;  // Interrupt entry and exit, vector through a function pointer
+static const uint32_t CYCLES_UDR    = 4;   // USART data or status access
+
+/// IEC line bit masks at Port D
+struct Pins {
+  uint8_t srq;
+  uint8_t atn;
+  uint8_t clk;
+  uint8_t dio;
+  uint8_t rst;
+};
+
+/// A device on the simulated IEC bus
+class Device {
+public:
+  Device() : wake(NEVER), drive(0) {};
+  virtual ~Device() {};
+  /// Bus line levels changed
+  /// @param lines are the line levels, a bit set for each released line
+  virtual void Change(uint8_t lines) = 0;
+  /// Scheduled wake time reached
+  virtual void Wake() = 0;
+
+  uint64_t wake;  // Cycle of next Wake(), NEVER for none
+  uint8_t drive;  // Lines asserted by the device
+};
+
+/// CPU time accounting [cycles]
+struct Counters {
+  uint64_t driver;    // IecHal calls from the main loop, bus waits included
+  uint64_t isr;       // Interrupt service, entry and exit included
+  uint64_t irqs;      // Interrupts served
+  uint64_t sleep;     // CPU sleeping, waiting for an interrupt
+  uint32_t overruns;  // Host link bytes lost in the USART
+};
+
+void Begin(const Pins& pins);
+void Attach(Device* device);
+const Pins& Iec();
+
+uint64_t Now();
+uint64_t Us(uint64_t us);
+void Run(uint64_t cycles);
+
+void Drive(Device* device, uint8_t lines);
+uint8_t Lines();
+
+void Feed(const uint8_t data[], size_t length, unsigned long baudrate);
+bool isFeeding();
+void SetPin(uint8_t pin, uint8_t level);
+void SetCtsPin(uint8_t pin);
+std::string& Output();
+
+const Counters& Count();
+
+}  // namespace Sim
@@ -0,0 +1,12 @@
+#!/bin/sh
+# Arduino style sketch preprocessing for the host build:
+# function prototypes first, then the sketch itself.
+# usage: sketch.sh iecprinter.ino > sketch.cpp
+ino="$1"
+echo '#include <Arduino.h>'
+grep -E '^#include' "$ino"
+grep -E '^[A-Za-z_][A-Za-z0-9_<>:*& ]* [A-Za-z_][A-Za-z0-9_]*\([^;]*\) *\{' "$ino" |
+  grep -vE '^(static |ISR|typedef|struct|class|enum|namespace|template)' |
+  sed -e 's/ *{.*$/;/' -e 's/ *= *[^,)]*//g'
+echo "#line 1 \"$ino\""
+cat "$ino"
@@ -0,0 +1,32 @@
+/**************************************************************
+ * util/atomic.h
+ * Host build of the avr-libc atomic blocks
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ **************************************************************/
+
+#pragma once
+
+#include <avr/interrupt.h>
+
+// Restoring the interrupt flag delivers pending interrupts
+void SimRestoreSreg(uint8_t sreg);
+
+static inline uint8_t __iCliRetVal() {
+  cli();
+  return 1;
+}
+
+static inline void __iRestore(const uint8_t* sreg) {
+  SimRestoreSreg(*sreg);
+}
+
+static inline void __iSeiParam(const uint8_t*) {
+  sei();
+}
+
+#define ATOMIC_BLOCK(type) for (type, __ToDo = __iCliRetVal(); __ToDo; __ToDo = 0)
+#define ATOMIC_RESTORESTATE uint8_t sreg_save __attribute__((__cleanup__(__iRestore))) = SREG
+#define ATOMIC_FORCEON uint8_t sreg_save __attribute__((__cleanup__(__iSeiParam))) = 0
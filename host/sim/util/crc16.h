@@ -0,0 +1,21 @@
+/**************************************************************
+ * util/crc16.h
+ * Host build of the avr-libc CRC helpers
+ * Part of the IEC bus simulator
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ **************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+/// CRC-16/XMODEM update, polynomial 0x1021
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data) {
+  crc ^= (uint16_t)data << 8;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+  }
+  return crc;
+}
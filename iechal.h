@@ -0,0 +1,231 @@
+/**************************************************************
+ * iechal.h
+ * IEC bus hardware access layer
+ * A class for USB to Commodore IEC Serial Bus interface
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+/**************************************************************
+ * Every hardware access of IecSerial goes through IecHal:
+ *   Lines    : IEC lines on the backend port, open collector emulation
+ *   Time     : micros(), busy wait and cycle counted delays
+ *   Sleep    : low power wait for the next interrupt, polling if none
+ *   Timer    : free running 16 bit time base and compare alarm
+ *   PinWatch : pin change interrupt on the handshake line
+ *   BitClock : data bits clocked out by hardware, if the board can
+ *
+ * The backend is chosen by the board the sketch is built for:
+ *   ATmega328P (Uno, Nano) : Port D, Timer1, PCINT2
+ *   ATmega32U4 (Leonardo, Micro) : Port D, Timer1, INT0 to INT3,
+ *     so DIO must be on PD0 to PD3
+ *   RP2040 : iechal_rp2040.h, PIO state machine clocks the bits
+ *   ESP32 : iechal_esp32.h
+ *   IEC_HOST : iechost.h, a simulated bus on a host computer (host/sim)
+ * On AVR these are inline register accesses, the same code IecSerial
+ * had before. Port policy bit masks are bits of the backend IEC port.
+ *
+ * Backends with IEC_HAL_CALLBACKS call IecHal::TimerEvent() and
+ * IecHal::PinEvent() from their interrupt handlers, the others have
+ * the interrupt vectors in iecserial.cpp.
+ **************************************************************/
+
+#if defined(IEC_HOST)
+#include "iechost.h"
+#elif defined(ARDUINO_ARCH_RP2040)
+#include "iechal_rp2040.h"
+#elif defined(ARDUINO_ARCH_ESP32)
+#include "iechal_esp32.h"
+#else
+
+#include <Arduino.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/delay_basic.h>
+#include <avr/sleep.h>
+
+namespace IecHal {
+
+// Timer1 ticks per microsecond (prescaler 8)
+constexpr unsigned int TICKS_PER_US = F_CPU / 8000000UL;
+// Data bits are clocked by IecSerial
+constexpr bool BIT_CLOCK = false;
+
+/// Set up IEC lines. Release() sets the pull-ups on AVR
+/// @param pins are the bits on PORTD of all IEC lines
+inline void Begin(uint8_t pins) {
+}
+
+/// Assert IEC bus lines by pulling them low
+/// @param pins are the bits on PORTD to assert (low level)
+inline void Assert(uint8_t pins) __attribute__((always_inline));
+inline void Assert(uint8_t pins) {
+  PORTD &= ~pins;  // pullup resistor off, low level(before switching to output)
+  DDRD  |= pins;   // pin mode = output
+}
+
+/// Release IEC bus lines by switching them to input mode
+/// @param pins are the bits on PORTD to release (high level)
+inline void Release(uint8_t pins) __attribute__((always_inline));
+inline void Release(uint8_t pins) {
+  DDRD  &= ~pins;  // pin mode = input
+  PORTD |= pins;   // Pullup resistor On
+}
+
+/// Read IEC bus line levels
+/// @return Port D input levels, a bit set for each released line
+inline uint8_t Lines() __attribute__((always_inline));
+inline uint8_t Lines() {
+  return PIND;
+}
+
+/// @return microseconds since startup
+inline unsigned long Micros() {
+  return micros();
+}
+
+/// Busy wait
+/// @param us is the time to wait [us]
+inline void DelayMicros(unsigned int us) {
+  delayMicroseconds(us);
+}
+
+/// Cycle counted busy wait, 4 cycles per loop
+/// @param loops is the number of loops, 1 to 65535
+inline void DelayLoop(uint16_t loops) __attribute__((always_inline));
+inline void DelayLoop(uint16_t loops) {
+  _delay_loop_2(loops);
+}
+
+/// Wait
+/// @param ms is the time to wait [ms]
+inline void Delay(unsigned long ms) {
+  delay(ms);
+}
+
+/// Wait for the next interrupt in idle sleep mode, peripherals running.
+/// Timer0 overflow (millis) wakes it at least every 1024 us.
+/// The condition is tested with interrupts off, and sei() only takes
+/// effect after sleep_cpu(), so an interrupt ending the wait right after
+/// the test still wakes the CPU (avr-libc race free sleep).
+/// @param busy returns true while the wait goes on
+template<class Busy>
+inline void Sleep(Busy busy) {
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  if (busy()) {
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+  }
+  sei();
+}
+
+/// Called on each pass of a busy wait for an interrupt driven event
+/// @param busy returns true while the event is pending
+template<class Busy>
+inline void Spin(Busy busy) {
+  Sleep(busy);
+}
+
+/// Run Timer1 free at clk/8, the time base of handshake timing
+inline void TimerBegin() {
+  TCCR1A = 0;           // Timer1 normal mode
+  TCCR1B = _BV(CS11);   // clk/8
+}
+
+/// @return Timer1 count
+inline uint16_t TimerCount() __attribute__((always_inline));
+inline uint16_t TimerCount() {
+  return TCNT1;
+}
+
+/// Interrupt on Timer1 compare A match, then again every Timer1 period
+/// @param at is the Timer1 count to match
+inline void TimerAlarm(uint16_t at) {
+  OCR1A = at;
+  TIFR1 = _BV(OCF1A);
+  TIMSK1 |= _BV(OCIE1A);
+}
+
+/// Stop Timer1 compare A interrupts
+inline void TimerAlarmOff() {
+  TIMSK1 &= ~_BV(OCIE1A);
+}
+
+#if defined(__AVR_ATmega32U4__)
+
+/// Interrupt on a change of Port D pins, external interrupts INT0 to INT3
+/// @param pins are the bits on PORTD to watch, PD0 to PD3
+inline void PinWatch(uint8_t pins) {
+  uint8_t sense = 0;  // ISCn1:ISCn0 bits of the watched interrupts
+  for (uint8_t n = 0; n < 4; n++) {
+    if (pins & _BV(n)) {
+      sense |= 0x03 << (2 * n);
+    }
+  }
+  EICRA = (EICRA & ~sense) | (0x55 & sense);  // any edge, others kept
+  EIFR = pins & 0x0F;
+  EIMSK |= pins & 0x0F;
+}
+
+/// Stop Port D pin change interrupts
+inline void PinWatchOff() {
+  EIMSK &= ~0x0F;
+}
+
+/// @return true if Port D pin change interrupts are enabled
+inline bool isPinWatched() {
+  return (EIMSK & 0x0F);
+}
+
+#else
+
+/// Interrupt on a change of Port D pins
+/// @param pins are the bits on PORTD to watch
+inline void PinWatch(uint8_t pins) {
+  PCMSK2 = pins;
+  PCIFR = _BV(PCIF2);
+  PCICR |= _BV(PCIE2);
+}
+
+/// Stop Port D pin change interrupts
+inline void PinWatchOff() {
+  PCICR &= ~_BV(PCIE2);
+}
+
+/// @return true if Port D pin change interrupts are enabled
+inline bool isPinWatched() {
+  return (PCICR & _BV(PCIE2));
+}
+
+#endif
+
+/// Clock the 8 data bits of a byte out by hardware, not on AVR
+inline void BitClock(uint8_t clk, uint8_t dio, uint8_t data, uint8_t ts, uint8_t tv) {
+}
+
+}  // namespace IecHal
+
+#endif
@@ -0,0 +1,67 @@
+/**************************************************************
+ * iechal_esp32.cpp
+ * IEC bus hardware access layer, ESP32 backend interrupts
+ * A class for USB to Commodore IEC Serial Bus interface
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#if defined(ARDUINO_ARCH_ESP32) && !defined(IEC_HOST)
+
+#include "iechal.h"
+
+hw_timer_t* IecHal::s_timer = 0;
+volatile uint64_t IecHal::s_alarmAt;
+volatile uint8_t IecHal::s_watched = 0;
+portMUX_TYPE IecHal::s_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/// Timer alarm interrupt, re-armed one 16 bit period later
+static void IRAM_ATTR TimerIrq() {
+  IecHal::s_alarmAt += 0x10000ULL;
+  timerAlarmWrite(IecHal::s_timer, IecHal::s_alarmAt, false);
+  timerAlarmEnable(IecHal::s_timer);
+  IecHal::TimerEvent();
+}
+
+/// GPIO edge interrupt of the IEC lines
+static void IRAM_ATTR PinIrq() {
+  if (IecHal::s_watched) {
+    IecHal::PinEvent();
+  }
+}
+
+/// Set up IEC lines as inputs with pull-ups, start the hardware timer
+/// and hook the interrupt handlers, line interrupts left disabled
+/// @param pins are the IEC port bits of all IEC lines
+void IecHal::Begin(uint8_t pins) {
+  uint32_t mask = (uint32_t)pins << IEC_GPIO_BASE;
+  for (uint8_t pin = 0; pin < 32; pin++) {
+    if (mask & (1UL << pin)) {
+      pinMode(pin, INPUT_PULLUP);
+      attachInterrupt(pin, PinIrq, CHANGE);
+      gpio_intr_disable((gpio_num_t)pin);
+    }
+  }
+  GPIO.out_w1tc = mask;  // output level low
+  s_timer = timerBegin(0, 40, true);
+  timerAttachInterrupt(s_timer, TimerIrq, true);
+}
+
+#endif
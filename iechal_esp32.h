@@ -0,0 +1,188 @@
+/**************************************************************
+ * iechal_esp32.h
+ * IEC bus hardware access layer, ESP32 backend
+ * A class for USB to Commodore IEC Serial Bus interface
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+/**************************************************************
+ * ESP32 (Arduino-ESP32 2.x core) backend of IecHal:
+ *   Lines    : GPIO 0 to 31 registers, IEC port bit 0 at GPIO IEC_GPIO_BASE
+ *   Timer    : hardware timer 0 at 2 MHz, low 16 bits, alarm
+ *   PinWatch : GPIO edge interrupt on the handshake line
+ *
+ * Lines are open collector: GPIO output level stays low and the
+ * output enable asserts a line. Bits are clocked by IecSerial.
+ * ATOMIC_BLOCK(ATOMIC_RESTORESTATE) takes a critical section, so it
+ * also holds off the other core.
+ **************************************************************/
+
+#include <Arduino.h>
+#include <driver/gpio.h>
+#include <soc/gpio_struct.h>
+
+#ifndef IEC_GPIO_BASE
+#define IEC_GPIO_BASE  11  ///< GPIO of IEC port bit 0, sketch pins 2 to 6 at GPIO13 to GPIO17
+#endif
+
+#define IEC_HAL_CALLBACKS  ///< Backend interrupt handlers call TimerEvent() and PinEvent()
+
+namespace IecHal {
+
+// Hardware timer ticks per microsecond (80 MHz APB clock / 40)
+constexpr unsigned int TICKS_PER_US = 2;
+// Data bits are clocked by IecSerial
+constexpr bool BIT_CLOCK = false;
+
+extern hw_timer_t* s_timer;          // Hardware timer 0
+extern volatile uint64_t s_alarmAt;  // Timer count of the armed alarm
+extern volatile uint8_t s_watched;   // Watched IEC port bits
+extern portMUX_TYPE s_mux;           // ATOMIC_BLOCK critical section
+
+void Begin(uint8_t pins);
+
+// Called by the backend interrupt handlers, defined in iecserial.cpp
+void TimerEvent();
+void PinEvent();
+
+/// Assert IEC bus lines by pulling them low
+/// @param pins are the IEC port bits to assert (low level)
+inline void Assert(uint8_t pins) __attribute__((always_inline));
+inline void Assert(uint8_t pins) {
+  GPIO.enable_w1ts = (uint32_t)pins << IEC_GPIO_BASE;
+}
+
+/// Release IEC bus lines, pull-ups set by Begin()
+/// @param pins are the IEC port bits to release (high level)
+inline void Release(uint8_t pins) __attribute__((always_inline));
+inline void Release(uint8_t pins) {
+  GPIO.enable_w1tc = (uint32_t)pins << IEC_GPIO_BASE;
+}
+
+/// Read IEC bus line levels
+/// @return IEC port input levels, a bit set for each released line
+inline uint8_t Lines() __attribute__((always_inline));
+inline uint8_t Lines() {
+  return GPIO.in >> IEC_GPIO_BASE;
+}
+
+/// @return microseconds since startup
+inline unsigned long Micros() {
+  return micros();
+}
+
+/// Busy wait
+/// @param us is the time to wait [us]
+inline void DelayMicros(unsigned int us) {
+  delayMicroseconds(us);
+}
+
+/// Cycle counted busy wait, 4 cycles per loop
+/// @param loops is the number of loops
+inline void DelayLoop(uint16_t loops) {
+  uint32_t start = ESP.getCycleCount();
+  while (ESP.getCycleCount() - start < 4UL * loops) {
+  }
+}
+
+/// Wait
+/// @param ms is the time to wait [ms]
+inline void Delay(unsigned long ms) {
+  delay(ms);
+}
+
+/// Low power wait for the next interrupt. None is periodic, so it polls
+template<class Busy>
+inline void Sleep(Busy) {
+}
+
+/// Called on each pass of a busy wait for an interrupt driven event
+template<class Busy>
+inline void Spin(Busy) {
+}
+
+/// The hardware timer runs from Begin()
+inline void TimerBegin() {
+}
+
+/// @return hardware timer count, low 16 bits
+inline uint16_t TimerCount() {
+  return timerRead(s_timer);
+}
+
+/// Interrupt when the low 16 bits of the timer match, then again every
+/// 65536 ticks, as the AVR Timer1 compare match
+/// @param at is the timer count to match
+inline void TimerAlarm(uint16_t at) {
+  uint64_t now = timerRead(s_timer);
+  uint16_t wait = at - (uint16_t)now;
+  s_alarmAt = now + (wait ? wait : 0x10000ULL);
+  timerAlarmWrite(s_timer, s_alarmAt, false);  // a passed alarm fires at once
+  timerAlarmEnable(s_timer);
+}
+
+/// Stop timer alarm interrupts
+inline void TimerAlarmOff() {
+  timerAlarmDisable(s_timer);
+}
+
+/// Interrupt on a change of IEC lines
+/// @param pins are the IEC port bits to watch, one line
+inline void PinWatch(uint8_t pins) {
+  GPIO.status_w1tc = (uint32_t)pins << IEC_GPIO_BASE;
+  s_watched = pins;
+  gpio_intr_enable((gpio_num_t)(IEC_GPIO_BASE + __builtin_ctz(pins)));
+}
+
+/// Stop IEC line change interrupts
+inline void PinWatchOff() {
+  if (s_watched) {
+    gpio_intr_disable((gpio_num_t)(IEC_GPIO_BASE + __builtin_ctz(s_watched)));
+    s_watched = 0;
+  }
+}
+
+/// @return true if IEC line change interrupts are enabled
+inline bool isPinWatched() {
+  return (s_watched != 0);
+}
+
+/// Clock the 8 data bits of a byte out by hardware, not on ESP32
+inline void BitClock(uint8_t clk, uint8_t dio, uint8_t data, uint8_t ts, uint8_t tv) {
+}
+
+/// Critical section for the scope of an ATOMIC_BLOCK
+class Critical {
+public:
+  Critical() : m_once(true) { portENTER_CRITICAL_SAFE(&s_mux); };
+  ~Critical() { portEXIT_CRITICAL_SAFE(&s_mux); };
+  bool Once() { bool once = m_once; m_once = false; return once; };
+private:
+  bool m_once;
+};
+
+}  // namespace IecHal
+
+// avr-libc util/atomic.h equivalent, restores the interrupt state on exit
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type)  for (IecHal::Critical iecCritical; iecCritical.Once(); )
@@ -0,0 +1,194 @@
+/**************************************************************
+ * iechal_rp2040.cpp
+ * IEC bus hardware access layer, RP2040 backend interrupts and PIO program
+ * A class for USB to Commodore IEC Serial Bus interface
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#if defined(ARDUINO_ARCH_RP2040) && !defined(IEC_HOST)
+
+#include "iechal.h"
+#include <hardware/clocks.h>
+#include <hardware/irq.h>
+#include <hardware/pio.h>
+#include <hardware/timer.h>
+
+/**************************************************************
+ * PIO bit clocking program, 10 cycles per microsecond. Side-set
+ * drives the CLK pin direction, out and set the DIO pin direction:
+ * direction 1 asserts a line, the pin output level being low.
+ *
+ *           set    y, 7                ; 8 bits
+ *   bit:    pull   block       side 1  ; CLK asserted, preparing bit
+ *           out    x, 15               ; half set-up time
+ *           mov    isr, x
+ *   prep:   jmp    x--, prep
+ *           out    pindirs, 1          ; DIO: bit inverted
+ *           mov    x, isr
+ *   setup:  jmp    x--, setup
+ *           out    x, 16       side 0  ; CLK released, bit valid
+ *   valid:  jmp    x--, valid
+ *           jmp    y--, bit
+ *           set    pindirs, 0          ; DIO released
+ *           irq    0           side 1  ; CLK asserted, byte sent
+ *
+ * One FIFO word per bit: half set-up time (15 bits), DIO direction,
+ * valid time (16 bits), in PIO cycles less the program overhead.
+ * The joined 8 word TX FIFO holds a whole byte.
+ **************************************************************/
+
+static const uint16_t BitProgramCode[] = {
+  0xE047,  //  0: set    y, 7
+  0x98A0,  //  1: pull   block       side 1
+  0x602F,  //  2: out    x, 15
+  0xA0C1,  //  3: mov    isr, x
+  0x0044,  //  4: jmp    x--, 4
+  0x6081,  //  5: out    pindirs, 1
+  0xA026,  //  6: mov    x, isr
+  0x0047,  //  7: jmp    x--, 7
+  0x7030,  //  8: out    x, 16       side 0
+  0x0049,  //  9: jmp    x--, 9
+  0x0081,  // 10: jmp    y--, 1
+  0xE080,  // 11: set    pindirs, 0
+  0xD800,  // 12: irq    0           side 1
+};
+static const pio_program BitProgram = { BitProgramCode, 13, -1 };
+
+// PIO cycles per microsecond
+static constexpr uint8_t PIO_TICKS_PER_US = 10;
+// Program cycles outside the delay loops
+static constexpr uint8_t PIO_CYCLES_SETUP = 3;  // DIO change to CLK release, also 1 less than CLK assert to DIO change
+static constexpr uint8_t PIO_CYCLES_VALID = 3;  // CLK release to next CLK assert
+
+uint8_t IecHal::s_alarm;
+volatile uint32_t IecHal::s_alarmAt;
+volatile uint8_t IecHal::s_watched = 0;
+
+static PIO s_pio = pio0;
+static uint s_sm;
+static uint8_t s_clkPin = 0xFF;  // PIO pins, not set up yet
+static uint8_t s_dioPin = 0xFF;
+
+/// Timer alarm interrupt, re-armed one 16 bit period later
+static void TimerIrq() {
+  hw_clear_bits(&timer_hw->intf, 1UL << IecHal::s_alarm);
+  timer_hw->intr = 1UL << IecHal::s_alarm;
+  IecHal::s_alarmAt += 0x10000UL;
+  timer_hw->alarm[IecHal::s_alarm] = IecHal::s_alarmAt;
+  IecHal::TimerEvent();
+}
+
+/// GPIO edge interrupt of the watched IEC line
+static void PinIrq() {
+  uint8_t watched = IecHal::s_watched;
+  if (watched) {
+    gpio_acknowledge_irq(IEC_GPIO_BASE + __builtin_ctz(watched),
+                         GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL);
+    IecHal::PinEvent();
+  }
+}
+
+/// PIO byte sent: CLK and DIO back to SIO, in the state the PIO left them
+static void BitIrq() {
+  pio_interrupt_clear(s_pio, 0);
+  sio_hw->gpio_oe_set = 1UL << s_clkPin;  // CLK asserted
+  sio_hw->gpio_oe_clr = 1UL << s_dioPin;  // DIO released
+  gpio_set_function(s_clkPin, GPIO_FUNC_SIO);
+  gpio_set_function(s_dioPin, GPIO_FUNC_SIO);
+  IecHal::TimerEvent();
+}
+
+/// Set up IEC lines as inputs with pull-ups, claim a timer alarm and
+/// hook the interrupt handlers
+/// @param pins are the IEC port bits of all IEC lines
+void IecHal::Begin(uint8_t pins) {
+  uint32_t mask = (uint32_t)pins << IEC_GPIO_BASE;
+  for (uint pin = 0; pin < 32; pin++) {
+    if (mask & (1UL << pin)) {
+      gpio_init(pin);
+      gpio_pull_up(pin);
+    }
+  }
+  sio_hw->gpio_clr = mask;     // output level low
+  sio_hw->gpio_oe_clr = mask;  // released
+  s_alarm = hardware_alarm_claim_unused(true);
+  irq_set_exclusive_handler(TIMER_IRQ_0 + s_alarm, TimerIrq);
+  irq_set_enabled(TIMER_IRQ_0 + s_alarm, true);
+  gpio_add_raw_irq_handler_masked(mask, PinIrq);
+  irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+/// Load the PIO program and set up its state machine for CLK and DIO
+static void BitClockBegin(uint8_t clkPin, uint8_t dioPin) {
+  static int offset = -1;
+  if (offset < 0) {
+    offset = pio_add_program(s_pio, &BitProgram);
+    s_sm = pio_claim_unused_sm(s_pio, true);
+    pio_set_irq0_source_enabled(s_pio, pis_interrupt0, true);
+    irq_set_exclusive_handler(PIO0_IRQ_0, BitIrq);
+    irq_set_enabled(PIO0_IRQ_0, true);
+  }
+  pio_sm_set_enabled(s_pio, s_sm, false);
+  s_clkPin = clkPin;
+  s_dioPin = dioPin;
+  pio_sm_config c = pio_get_default_sm_config();
+  sm_config_set_wrap(&c, offset, offset + BitProgram.length - 1);
+  sm_config_set_sideset(&c, 2, true, true);  // optional, pin directions
+  sm_config_set_sideset_pins(&c, clkPin);
+  sm_config_set_out_pins(&c, dioPin, 1);
+  sm_config_set_set_pins(&c, dioPin, 1);
+  sm_config_set_out_shift(&c, true, false, 32);
+  sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX);
+  sm_config_set_clkdiv(&c, (float)clock_get_hz(clk_sys) / (PIO_TICKS_PER_US * 1000000UL));
+  uint32_t mask = (1UL << clkPin) | (1UL << dioPin);
+  pio_sm_set_pins_with_mask(s_pio, s_sm, 0, mask);
+  pio_sm_set_pindirs_with_mask(s_pio, s_sm, 1UL << clkPin, mask);  // as left after a byte
+  pio_sm_init(s_pio, s_sm, offset, &c);
+  pio_sm_set_enabled(s_pio, s_sm, true);
+}
+
+/// Clock the 8 data bits of a byte out, LSB first. Called with CLK and DIO
+/// released. TimerEvent() is called when done, with DIO released and CLK
+/// asserted, as after the bit states of the transmit engine.
+/// @param clk is the IEC port bit of CLK
+/// @param dio is the IEC port bit of DIO
+/// @param data is the byte to send
+/// @param ts is the bit set-up time [us]
+/// @param tv is the data valid time [us]
+void IecHal::BitClock(uint8_t clk, uint8_t dio, uint8_t data, uint8_t ts, uint8_t tv) {
+  uint8_t clkPin = IEC_GPIO_BASE + __builtin_ctz(clk);
+  uint8_t dioPin = IEC_GPIO_BASE + __builtin_ctz(dio);
+  if (clkPin != s_clkPin || dioPin != s_dioPin) {
+    BitClockBegin(clkPin, dioPin);
+  }
+  uint32_t half = (ts - ts / 2) * PIO_TICKS_PER_US - PIO_CYCLES_SETUP;
+  uint32_t valid = tv * PIO_TICKS_PER_US - PIO_CYCLES_VALID;
+  // CLK asserted as the PIO takes the pins, preparing the first bit
+  gpio_set_function(clkPin, GPIO_FUNC_PIO0);
+  gpio_set_function(dioPin, GPIO_FUNC_PIO0);
+  for (uint8_t bit = 0; bit < 8; bit++) {
+    uint32_t assert = (data & 1) ? 0 : 1;  // bit=0 -> Assert DIO (low)
+    pio_sm_put(s_pio, s_sm, valid << 16 | assert << 15 | half);
+    data >>= 1;
+  }
+}
+
+#endif
@@ -0,0 +1,195 @@
+/**************************************************************
+ * iechal_rp2040.h
+ * IEC bus hardware access layer, RP2040 backend
+ * A class for USB to Commodore IEC Serial Bus interface
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+/**************************************************************
+ * RP2040 (Raspberry Pi Pico, arduino-pico core) backend of IecHal:
+ *   Lines    : SIO GPIO, IEC port bit 0 at GPIO IEC_GPIO_BASE
+ *   Timer    : 1 MHz system timer, low 16 bits, a claimed alarm
+ *   PinWatch : GPIO edge interrupt on the handshake line
+ *   BitClock : a PIO state machine clocks the 8 data bits out
+ *
+ * Lines are open collector: GPIO output level stays low and the
+ * output enable asserts a line. The PIO program drives pin
+ * directions the same way, CLK and DIO are handed to it for the bits
+ * of a byte and back to SIO when it raises its interrupt.
+ * ATOMIC_BLOCK(ATOMIC_RESTORESTATE) masks interrupts as on AVR.
+ **************************************************************/
+
+#include <Arduino.h>
+#include <hardware/gpio.h>
+#include <hardware/sync.h>
+#include <hardware/structs/sio.h>
+#include <hardware/structs/timer.h>
+
+#ifndef IEC_GPIO_BASE
+#define IEC_GPIO_BASE  2  ///< GPIO of IEC port bit 0, sketch pins 2 to 6 at GP4 to GP8
+#endif
+
+#define IEC_HAL_CALLBACKS  ///< Backend interrupt handlers call TimerEvent() and PinEvent()
+
+namespace IecHal {
+
+// System timer ticks per microsecond
+constexpr unsigned int TICKS_PER_US = 1;
+// Data bits are clocked by a PIO state machine
+constexpr bool BIT_CLOCK = true;
+
+extern uint8_t s_alarm;              // Claimed timer alarm
+extern volatile uint32_t s_alarmAt;  // Timer count of the armed alarm
+extern volatile uint8_t s_watched;   // Watched IEC port bits
+
+void Begin(uint8_t pins);
+void BitClock(uint8_t clk, uint8_t dio, uint8_t data, uint8_t ts, uint8_t tv);
+
+// Called by the backend interrupt handlers, defined in iecserial.cpp
+void TimerEvent();
+void PinEvent();
+
+/// Assert IEC bus lines by pulling them low
+/// @param pins are the IEC port bits to assert (low level)
+inline void Assert(uint8_t pins) __attribute__((always_inline));
+inline void Assert(uint8_t pins) {
+  sio_hw->gpio_oe_set = (uint32_t)pins << IEC_GPIO_BASE;
+}
+
+/// Release IEC bus lines, pull-ups set by Begin()
+/// @param pins are the IEC port bits to release (high level)
+inline void Release(uint8_t pins) __attribute__((always_inline));
+inline void Release(uint8_t pins) {
+  sio_hw->gpio_oe_clr = (uint32_t)pins << IEC_GPIO_BASE;
+}
+
+/// Read IEC bus line levels
+/// @return IEC port input levels, a bit set for each released line
+inline uint8_t Lines() __attribute__((always_inline));
+inline uint8_t Lines() {
+  return sio_hw->gpio_in >> IEC_GPIO_BASE;
+}
+
+/// @return microseconds since startup
+inline unsigned long Micros() {
+  return micros();
+}
+
+/// Busy wait
+/// @param us is the time to wait [us]
+inline void DelayMicros(unsigned int us) {
+  delayMicroseconds(us);
+}
+
+/// Cycle counted busy wait, 4 cycles per loop
+/// @param loops is the number of loops
+inline void DelayLoop(uint16_t loops) {
+  busy_wait_at_least_cycles(4UL * loops);
+}
+
+/// Wait
+/// @param ms is the time to wait [ms]
+inline void Delay(unsigned long ms) {
+  delay(ms);
+}
+
+/// Low power wait for the next interrupt. None is periodic, so it polls
+template<class Busy>
+inline void Sleep(Busy) {
+}
+
+/// Called on each pass of a busy wait for an interrupt driven event
+template<class Busy>
+inline void Spin(Busy) {
+}
+
+/// The system timer always runs
+inline void TimerBegin() {
+}
+
+/// @return system timer count, low 16 bits
+inline uint16_t TimerCount() __attribute__((always_inline));
+inline uint16_t TimerCount() {
+  return timer_hw->timerawl;
+}
+
+/// Interrupt when the low 16 bits of the timer match, then again every
+/// 65536us, as the AVR Timer1 compare match
+/// @param at is the timer count to match
+inline void TimerAlarm(uint16_t at) {
+  uint32_t now = timer_hw->timerawl;
+  uint16_t wait = at - (uint16_t)now;
+  s_alarmAt = now + (wait ? wait : 0x10000UL);
+  timer_hw->intr = 1UL << s_alarm;
+  hw_set_bits(&timer_hw->inte, 1UL << s_alarm);
+  timer_hw->alarm[s_alarm] = s_alarmAt;
+  if ((int32_t)(timer_hw->timerawl - s_alarmAt) >= 0) {
+    hw_set_bits(&timer_hw->intf, 1UL << s_alarm);  // passed while arming
+  }
+}
+
+/// Stop timer alarm interrupts
+inline void TimerAlarmOff() {
+  hw_clear_bits(&timer_hw->inte, 1UL << s_alarm);
+  timer_hw->armed = 1UL << s_alarm;
+}
+
+/// Interrupt on a change of IEC lines
+/// @param pins are the IEC port bits to watch, one line
+inline void PinWatch(uint8_t pins) {
+  uint pin = IEC_GPIO_BASE + __builtin_ctz(pins);
+  gpio_acknowledge_irq(pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL);
+  s_watched = pins;
+  gpio_set_irq_enabled(pin, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
+}
+
+/// Stop IEC line change interrupts
+inline void PinWatchOff() {
+  if (s_watched) {
+    gpio_set_irq_enabled(IEC_GPIO_BASE + __builtin_ctz(s_watched),
+                         GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, false);
+    s_watched = 0;
+  }
+}
+
+/// @return true if IEC line change interrupts are enabled
+inline bool isPinWatched() {
+  return (s_watched != 0);
+}
+
+/// Interrupts masked for the scope of an ATOMIC_BLOCK
+class Critical {
+public:
+  Critical() : m_state(save_and_disable_interrupts()), m_once(true) {};
+  ~Critical() { restore_interrupts(m_state); };
+  bool Once() { bool once = m_once; m_once = false; return once; };
+private:
+  uint32_t m_state;
+  bool m_once;
+};
+
+}  // namespace IecHal
+
+// avr-libc util/atomic.h equivalent, restores the interrupt state on exit
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type)  for (IecHal::Critical iecCritical; iecCritical.Once(); )
@@ -28,83 +28,520 @@
  **************************************************************/
 
 #include "iecserial.h"
+#include "usbserial.h"
+#include "spool.h"
+#include <EEPROM.h>
+#if defined(__AVR__) || defined(IEC_HOST)
+#include <avr/wdt.h>
+#endif
 
 //-----------------------------------------------
 // Definition of Arduino pins
 //-----------------------------------------------
 
-// IEC interface pins at Port D (Note: DIN-6 pin 2 is Ground)
+// IEC interface pins are bits of the IEC port of the board (see iechal.h)
+// Note: DIN-6 pin 2 is Ground
+#if defined(__AVR_ATmega32U4__)
+// Leonardo, Micro: Port D, DIO on an external interrupt pin (PD0 to PD3)
+#define IEC_SRQ   1  ///< PD1, Arduino D2  -> DIN-6 pin 1 : Service Request line
+#define IEC_ATN   7  ///< PD7, Arduino D6  -> DIN-6 pin 3 : Attention line
+#define IEC_CLK   4  ///< PD4, Arduino D4  -> DIN-6 pin 4 : Clock line
+#define IEC_DIO   0  ///< PD0, Arduino D3  -> DIN-6 pin 5 : Data I/O line
+#define IEC_RST   6  ///< PD6, Arduino D12 -> DIN-6 pin 6 : Reset line
+#elif defined(ARDUINO_ARCH_RP2040) || defined(ARDUINO_ARCH_ESP32)
+// GPIO from IEC_GPIO_BASE: RP2040 GP4 to GP8, ESP32 GPIO13 to GPIO17
+#define IEC_SRQ   2  ///< RP2040 GP4, ESP32 GPIO13 -> DIN-6 pin 1 : Service Request line
+#define IEC_ATN   6  ///< RP2040 GP8, ESP32 GPIO17 -> DIN-6 pin 3 : Attention line
+#define IEC_CLK   4  ///< RP2040 GP6, ESP32 GPIO15 -> DIN-6 pin 4 : Clock line
+#define IEC_DIO   5  ///< RP2040 GP7, ESP32 GPIO16 -> DIN-6 pin 5 : Data I/O line
+#define IEC_RST   3  ///< RP2040 GP5, ESP32 GPIO14 -> DIN-6 pin 6 : Reset line
+#else
+// Uno, Nano: Port D
 #define IEC_SRQ   2  ///< Arduino D2 -> DIN-6 pin 1 : Service Request line
 #define IEC_ATN   6  ///< Arduino D6 -> DIN-6 pin 3 : Attention line
 #define IEC_CLK   4  ///< Arduino D4 -> DIN-6 pin 4 : Clock line
 #define IEC_DIO   5  ///< Arduino D5 -> DIN-6 pin 5 : Data I/O line
 #define IEC_RST   3  ///< Arduino D3 -> DIN-6 pin 6 : Reset line
+#endif
 
+#if defined(ARDUINO_ARCH_RP2040)
+// Configuration switches to GND
+#define SW_PAD    9  ///< GP9  -> Selects Alternative Device Address
+#define SW_SAD    10 ///< GP10 -> Selects Business Mode
+#define SW_ASCII  11 ///< GP11 -> Interpret data as ASCII (else PETSCII)
+#define SW_XON    12 ///< GP12 -> Enables XON/XOFF flow control
+#define SW_RTS    13 ///< GP13 -> Enables RTS/CTS flow control
+
+#define SW_SPOOL  14 ///< GP14 -> Enables spooling to external storage
+#define SW_MIRROR 15 ///< GP15 -> Prints on both devices PAD and PAD_ALT
+
+// Hardware flow control output
+#define USB_CTS   20 ///< GP20 -> Clear To Send output, low when host may send
+
+// Spool storage chip select, SPI0 on GP16 (MISO), GP18 (SCK) and GP19 (MOSI)
+#define SPOOL_CS  17 ///< GP17 -> SPI SRAM or SD card chip select
+#elif defined(ARDUINO_ARCH_ESP32)
+// Configuration switches to GND
+#define SW_PAD    21 ///< GPIO21 -> Selects Alternative Device Address
+#define SW_SAD    22 ///< GPIO22 -> Selects Business Mode
+#define SW_ASCII  25 ///< GPIO25 -> Interpret data as ASCII (else PETSCII)
+#define SW_XON    26 ///< GPIO26 -> Enables XON/XOFF flow control
+#define SW_RTS    27 ///< GPIO27 -> Enables RTS/CTS flow control
+
+#define SW_SPOOL  32 ///< GPIO32 -> Enables spooling to external storage
+#define SW_MIRROR 33 ///< GPIO33 -> Prints on both devices PAD and PAD_ALT
+
+// Hardware flow control output
+#define USB_CTS   4  ///< GPIO4 -> Clear To Send output, low when host may send
+
+// Spool storage chip select, VSPI on GPIO18 (SCK), GPIO19 (MISO) and GPIO23 (MOSI)
+#define SPOOL_CS  5  ///< GPIO5 -> SPI SRAM or SD card chip select
+#else
 // Configuration switches to GND
 #define SW_PAD    7  ///< Arduino D7 -> Selects Alternative Device Address
 #define SW_SAD    8  ///< Arduino D8 -> Selects Business Mode
 #define SW_ASCII  9  ///< Arduino D9 -> Interpret data as ASCII (else PETSCII)
+#define SW_XON    A0 ///< Arduino A0 -> Enables XON/XOFF flow control
+#define SW_RTS    A1 ///< Arduino A1 -> Enables RTS/CTS flow control
+
+#define SW_SPOOL  A3 ///< Arduino A3 -> Enables spooling to external storage
+#define SW_MIRROR A5 ///< Arduino A5 -> Prints on both devices PAD and PAD_ALT
+
+// Hardware flow control output
+#define USB_CTS   A2 ///< Arduino A2 -> Clear To Send output, low when host may send
+
+// Spool storage chip select, SPI on pins 11 (MOSI), 12 (MISO) and 13 (SCK)
+#define SPOOL_CS  10 ///< Arduino D10 -> SPI SRAM or SD card chip select
+#endif
 
 //-----------------------------------------------
 // Global defines and constants
 //-----------------------------------------------
 
-// Serial input buffer
-#define BUFFER_SIZE  1024  ///< Serial input buffer size
+// Spool backends
+#define SPOOL_NONE  0  ///< No external storage
+#define SPOOL_SRAM  1  ///< 23LC1024 SPI SRAM, 128K bytes
+#define SPOOL_SD    2  ///< SD card file
+#define SPOOL_TYPE  SPOOL_NONE  ///< Spool backend fitted
+#if SPOOL_TYPE == SPOOL_SD && (defined(__AVR__) || defined(IEC_HOST))
+#define SPOOL_CACHE 64   ///< Spool read cache size (power of two), SD library needs RAM
+#else
+#define SPOOL_CACHE 512  ///< Spool read cache size (power of two), holds a raster band of 480 dots
+#endif
+
+// Busy indicator. SPI SCK drives the on-board LED of Uno and Nano when a spool is fitted
+#if SPOOL_TYPE == SPOOL_NONE || !(defined(__AVR_ATmega328P__) || defined(IEC_HOST))
+#define LED_BUSY  LED_BUILTIN  ///< Busy LED pin
+#else
+#define LED_BUSY  A4           ///< Busy LED pin
+#endif
+
+// Serial input queue
+#if defined(ARDUINO_ARCH_RP2040) || defined(ARDUINO_ARCH_ESP32)
+#define BUFFER_SIZE  16384 ///< Serial input queue size (power of two), boards with more RAM
+#elif SPOOL_TYPE == SPOOL_SD
+#define BUFFER_SIZE  256   ///< Serial input queue size (power of two), SD library needs RAM
+#elif SPOOL_TYPE == SPOOL_SRAM
+#define BUFFER_SIZE  512   ///< Serial input queue size (power of two), RAM shared with the spool read cache
+#else
+#define BUFFER_SIZE  1024  ///< Serial input queue size (power of two)
+#endif
+#define START_LEVEL  (BUFFER_SIZE/2)  ///< Queued bytes that start printing before the print timeout
+#define START_LOW    (BUFFER_SIZE/8)  ///< Queued bytes that start printing with START_QUEUED policy
+
+// Print start policies: printing always starts at START_LEVEL or after the print timeout
+#define START_IDLE    0  ///< Start policy: only then
+#define START_LINE    1  ///< Start policy: also on a received line end
+#define START_QUEUED  2  ///< Start policy: also at START_LOW queued bytes
+#define START_NOW     3  ///< Start policy: at the first byte, printed as it arrives
+#define START_POLICY  START_IDLE  ///< Default start policy setting
 
 // Serial interface
-#define BAUDRATE  9600  ///< Serial interface baud rate
-#define TIMEOUT   1000  ///< Serial input timeout [ms] before sending buffered data to printer
+#define BAUDRATE  9600  ///< Serial interface baud rate, up to 1000000, when auto-baud detects none and none is stored
+#define AUTOBAUD  2000  ///< Time [ms] waiting for an auto-baud 'U' character at startup or after a break, 0 disables
+#define TIMEOUT   1000  ///< Serial input idle time [ms] before sending queued data to printer, default setting
+
+// Print session
+#define SESSION_TIMEOUT  3000  ///< Serial input idle time [ms] before ending a print job with EOI, default setting
+#define JOB_END          0x04  ///< End of job marker (EOT, Ctrl-D), ends a print job with EOI
+
+// Job header: JOB_START, device address, secondary address, JOB_PETSCII or mode flags
+#define JOB_START        0x01  ///< Job header marker (SOH), routes the following data
+#define JOB_HEADER_SIZE  4     ///< Job header size including marker
+#define JOB_PETSCII      0     ///< Job header mode: PETSCII data
+#define JOB_ASCII        1     ///< Job header mode flag: ASCII data, translated
+#define JOB_MIRROR       2     ///< Job header mode flag: print on both PAD and PAD_ALT
+#define JOB_RASTER       4     ///< Job header mode flag: PBM (P4) raster images, printed as bit images
+#define JOB_ESCAPED      8     ///< Job header mode flag: PETSCII data bytes equal to a job marker or JOB_ESCAPE follow a JOB_ESCAPE
+#define JOB_ESCAPE       0x10  ///< Escape (DLE) in front of a data byte in JOB_ESCAPED jobs
+
+// Interface commands: a job header addressed to INTERFACE_DEVICE, command and argument
+// in place of the secondary address and mode. Device 0 is never a printer.
+#define INTERFACE_DEVICE  0    ///< Job header device address of interface commands
+#define QUERY_STATS       'S'  ///< Command: report bus statistics, argument 1 clears them after
+#define LOAD_GLYPH        'G'  ///< Command: custom glyph for the ASCII code argument, GLYPH_COLUMNS bytes follow. 0 clears all
+#define SET_SETTING       'C'  ///< Command: set the setting named by the argument, SETTING_VALUE_SIZE bytes follow
+#define SETTINGS          'W'  ///< Command: SETTINGS_REPORT, SETTINGS_SAVE or SETTINGS_ERASE argument
+
+// Settings changed by interface commands, in place of the configuration switches.
+// A value is 4 bytes, least significant first
+#define SETTING_PAD         'P'  ///< Setting: device address, PAD to PAD_LAST
+#define SETTING_SAD         'A'  ///< Setting: secondary address, 0 to 15
+#define SETTING_MODE        'M'  ///< Setting: JOB_ASCII and JOB_MIRROR mode flags
+#define SETTING_FLOW        'F'  ///< Setting: UsbSerial flow control mode
+#define SETTING_BAUD        'B'  ///< Setting: serial baud rate, 0 detects it at startup
+#define SETTING_TIMEOUT     'T'  ///< Setting: serial input idle time [ms] before sending queued data
+#define SETTING_SESSION     'E'  ///< Setting: serial input idle time [ms] before ending a print job
+#define SETTING_TIMING      'I'  ///< Setting: IEC timing profile, TIMING_TUNED or TIMING_FIXED
+#define SETTING_START       'S'  ///< Setting: print start policy, START_IDLE to START_NOW
+#define SETTING_VALUE_SIZE  4    ///< Setting value bytes
+#define SETTINGS_REPORT     'R'  ///< Settings command argument: report settings
+#define SETTINGS_SAVE       'S'  ///< Settings command argument: store settings in EEPROM
+#define SETTINGS_ERASE      'E'  ///< Settings command argument: erase stored settings, back to the switches
+
+// Raster images
+#define RASTER_ROWS  7  ///< Raster rows per printed bit image line
+
+// Bus error recovery
+#define BUS_RETRIES  2        ///< Bus resets tried per print session before aborting it
+#define WATCHDOG     WDTO_8S  ///< Watchdog timeout around the print loop, undefine for old Nano bootloaders
+
+// Power saving
+#define LOW_POWER  1  ///< Sleep between main loop passes until an interrupt, 0 keeps polling at full power
+
+// Board support. RP2040 and ESP32 emulate EEPROM in flash and have no AVR watchdog
+#if defined(__AVR__) || defined(IEC_HOST)
+#define BOARD_AVR             ///< AVR reset flags and watchdog
+#define EEPROM_EMULATED  0    ///< MCU EEPROM, no begin() nor commit()
+#else
+#undef WATCHDOG
+#define wdt_reset()
+#define EEPROM_EMULATED  512  ///< Flash emulated EEPROM size
+#endif
+
+// Staging buffer for translated data
+#define STAGE_SIZE           64  ///< Staging buffer size, at least STAGE_MAX_EXPANSION
+// A broken UTF-8 sequence flushes each held byte and the received one, any of them a custom glyph
+#define STAGE_MAX_EXPANSION  (1 + UTF8_HELD * GLYPH_SIZE + GLYPH_SIZE + REPEAT_HELD)  ///< Max staged bytes for one received byte
+
+// ASCII line formatter
+#define LINE_WIDTH  80  ///< Printer line width [characters], words wrap before it. 0 disables the formatter
+#define TAB_WIDTH   8   ///< Columns between tab stops
+
+// ASCII mode character set
+#define UTF8_TEXT  1  ///< Decode UTF-8 text, other 8 bit codes print as PETSCII graphics. 0 disables
+#define UTF8_HELD  3  ///< Max bytes held by the UTF-8 decoder, printed as 8 bit codes if not UTF-8
+
+// Bit image repeat encoder
+#define REPEAT_MIN   4  ///< Shortest bit image column run sent as a repeat command, 0 disables the encoder
+#define REPEAT_MAX   255  ///< Longest column run in a repeat command
+#define REPEAT_HELD  (REPEAT_MIN + 3)  ///< Max bytes held by the encoder
+
+// IEC fast serial protocols tried at LISTEN, standard protocol if not supported.
+// Add IecBus::FAST_BURST for CBM fast serial targets: stock printers get the
+// first byte of each job with EOI while fast serial is being verified.
+#define FAST_SERIAL  (IecBus::FAST_JIFFY)  ///< IecBus::FAST_NONE to disable
+
+// IEC bus timing calibration
+#define CALIBRATION_BYTES  16    ///< Bytes measured to tune bus timing for a new device
+#define EEPROM_TIMING      0     ///< EEPROM address of timing profiles, one per device address
+#define TIMING_VALID       0xA5  ///< Marks a stored timing profile as valid
+#define TIMING_MIRROR      0     ///< Profile slot for mirror mode, device 0 is never a printer
+#define TIMING_TUNED       0     ///< Timing profile setting: tuned for each device and stored
+#define TIMING_FIXED       1     ///< Timing profile setting: conservative timing, never tuned
+
+// Custom glyphs loaded by the host, printed in place of an ASCII code
+#define GLYPH_CACHE    8     ///< Custom glyphs stored
+#define EEPROM_GLYPHS  (EEPROM_TIMING + (PAD_LAST + 1) * (1 + sizeof(IecTiming)))  ///< EEPROM address of custom glyphs, code and columns each
+#define GLYPH_FREE     0xFF  ///< Code of an unused custom glyph
+
+// Settings stored in EEPROM, the switches apply if none
+#define EEPROM_SETTINGS  (EEPROM_GLYPHS + GLYPH_CACHE * (1 + GLYPH_COLUMNS))  ///< EEPROM address of stored settings
+#define SETTINGS_VALID   0x5A  ///< Marks stored settings as valid
 
 // Printer Address
 #define PAD           4  ///< Printer Primary Address (default)
 #define PAD_ALT       5  ///< Printer Primary Address (alternative)
+#define PAD_LAST     30  ///< Highest Primary Address accepted in a job header
 #define SAD_GRAPH     0  ///< Secondary address for Printer Graphic Mode
 #define SAD_BUSINESS  7  ///< Secondary address for Printer Business Mode
 
+// Device status polling between jobs
+#define SAD_STATUS     15    ///< Secondary address of device status channel
+#define POLL_INTERVAL  1000  ///< Time [ms] between status polls while idle, one device per poll
+#define STATUS_SIZE    41    ///< Status message buffer size
+#define STATUS_ERROR   20    ///< First status code reporting a device error
+#define DEVICE_BIT(d)  (1UL << (d))  ///< Device address bit in a device set
+
 // Printer special commands
 #define CMD_IMAGE_BEGIN  0x08  ///< Start bit image data
 #define CMD_IMAGE_END    0x0F  ///< Terminate bit image data
+#define CMD_IMAGE_REPEAT 0x1A  ///< Repeat bit image column: CMD_IMAGE_REPEAT, count, column
+#define IMAGE_COLUMN     0x80  ///< Bit image column bytes have bit 7 set
 #define CMD_BUSINESS     0x11  ///< Set printer to Business mode
 
 // ASCII codes
 #define CR            0x0D
 #define LF            0x0A
-#define DOUBLE_QUOTES 0x22
-#define SINGLE_QUOTE  0x27
-#define BACKSLASH     0x5C
-#define GRAVE_ACCENT  0x60
+#define TAB           0x09
 
 // PETSCII codes
 #define PETSCII_UNDERSCORE  0xA4
 
 // Bit image glyphs for ASCII translation
-#define GLYPH_SIZE  8  // All glyphs are 6 bit columns + 2 command bytes
-static const uint8_t DoubleQuotesImg[GLYPH_SIZE] = { CMD_IMAGE_BEGIN, 0x80, 0x87, 0x80, 0x87, 0x80, 0x80, CMD_IMAGE_END };
-static const uint8_t SingleQuoteImg[GLYPH_SIZE]  = { CMD_IMAGE_BEGIN, 0x80, 0x80, 0x87, 0x80, 0x80, 0x80, CMD_IMAGE_END };
-static const uint8_t BackslashImg[GLYPH_SIZE]    = { CMD_IMAGE_BEGIN, 0x83, 0x84, 0x88, 0x90, 0xA0, 0x80, CMD_IMAGE_END };
-static const uint8_t GraveAccentImg[GLYPH_SIZE]  = { CMD_IMAGE_BEGIN, 0x80, 0x81, 0x82, 0x84, 0x80, 0x80, CMD_IMAGE_END };
-static const uint8_t OpenBraceImg[GLYPH_SIZE]    = { CMD_IMAGE_BEGIN, 0x88, 0xB6, 0xC1, 0xC1, 0x80, 0x80, CMD_IMAGE_END };
-static const uint8_t CloseBraceImg[GLYPH_SIZE]   = { CMD_IMAGE_BEGIN, 0x80, 0xC1, 0xC1, 0xB6, 0x88, 0x80, CMD_IMAGE_END };
-static const uint8_t TildeImg[GLYPH_SIZE]        = { CMD_IMAGE_BEGIN, 0x81, 0x82, 0x83, 0x81, 0x82, 0x80, CMD_IMAGE_END };
-static const uint8_t HatImg[GLYPH_SIZE]          = { CMD_IMAGE_BEGIN, 0x84, 0x82, 0x81, 0x82, 0x84, 0x80, CMD_IMAGE_END };
-static const uint8_t VerticalBarImg[GLYPH_SIZE]  = { CMD_IMAGE_BEGIN, 0x80, 0x80, 0xFF, 0x80, 0x80, 0x80, CMD_IMAGE_END };
+#define GLYPH_COLUMNS  6  // All glyphs are 6 bit columns
+#define GLYPH_SIZE     (GLYPH_COLUMNS + 2)  // Staged glyph size, with bit image begin and end
+#define GLYPH_COUNT    31  // Number of glyphs, numbers below 0x20
+#define GLYPH_ASCII    9   // Glyphs of AsciiTable, numbers below LF
+static const uint8_t GlyphImg[GLYPH_COUNT][GLYPH_COLUMNS] PROGMEM = {
+  { 0x80, 0x87, 0x80, 0x87, 0x80, 0x80 },  // G_DOUBLE_QUOTES
+  { 0x80, 0x80, 0x87, 0x80, 0x80, 0x80 },  // G_SINGLE_QUOTE
+  { 0x83, 0x84, 0x88, 0x90, 0xA0, 0x80 },  // G_BACKSLASH
+  { 0x80, 0x81, 0x82, 0x84, 0x80, 0x80 },  // G_GRAVE_ACCENT
+  { 0x88, 0xB6, 0xC1, 0xC1, 0x80, 0x80 },  // G_OPEN_BRACE
+  { 0x80, 0xC1, 0xC1, 0xB6, 0x88, 0x80 },  // G_CLOSE_BRACE
+  { 0x81, 0x82, 0x83, 0x81, 0x82, 0x80 },  // G_TILDE
+  { 0x84, 0x82, 0x81, 0x82, 0x84, 0x80 },  // G_HAT
+  { 0x80, 0x80, 0xFF, 0x80, 0x80, 0x80 },  // G_VERTICAL_BAR
+  { 0xA0, 0xD5, 0xD4, 0xD5, 0xF8, 0x80 },  // G_A_UMLAUT_SMALL
+  { 0xB8, 0xC5, 0xC4, 0xC5, 0xB8, 0x80 },  // G_O_UMLAUT_SMALL
+  { 0xBC, 0xC1, 0xC0, 0xA1, 0xFC, 0x80 },  // G_U_UMLAUT_SMALL
+  { 0xFD, 0x92, 0x92, 0x92, 0xFD, 0x80 },  // G_A_UMLAUT
+  { 0xBD, 0xC2, 0xC2, 0xC2, 0xBD, 0x80 },  // G_O_UMLAUT
+  { 0xBD, 0xC0, 0xC0, 0xC0, 0xBD, 0x80 },  // G_U_UMLAUT
+  { 0xFE, 0x81, 0xC9, 0xCE, 0xB0, 0x80 },  // G_SHARP_S
+  { 0xB8, 0xD4, 0xD6, 0xD5, 0x98, 0x80 },  // G_E_ACUTE
+  { 0xB8, 0xD5, 0xD6, 0xD4, 0x98, 0x80 },  // G_E_GRAVE
+  { 0xA0, 0xD5, 0xD6, 0xD4, 0xF8, 0x80 },  // G_A_GRAVE
+  { 0x8C, 0xD2, 0xF2, 0x92, 0x80, 0x80 },  // G_C_CEDILLA
+  { 0xFE, 0x89, 0x85, 0x86, 0xF9, 0x80 },  // G_N_TILDE
+  { 0x86, 0x89, 0x89, 0x86, 0x80, 0x80 },  // G_DEGREE
+  { 0x94, 0xBE, 0xD5, 0xD5, 0xC1, 0x80 },  // G_EURO
+  { 0xCA, 0xD5, 0xD5, 0xA9, 0x80, 0x80 },  // G_SECTION
+  { 0xC4, 0xC4, 0xDF, 0xC4, 0xC4, 0x80 },  // G_PLUS_MINUS
+  { 0xFE, 0xA0, 0xA0, 0x90, 0xBE, 0x80 },  // G_MICRO
+  { 0xA2, 0x94, 0x88, 0x94, 0xA2, 0x80 },  // G_TIMES
+  { 0x88, 0x88, 0xAA, 0x88, 0x88, 0x80 },  // G_DIVIDE
+  { 0xC0, 0x80, 0xC0, 0x80, 0xC0, 0x80 },  // G_ELLIPSIS
+  { 0x88, 0x94, 0xAA, 0x94, 0xA2, 0x80 },  // G_LEFT_GUILLEMET
+  { 0xA2, 0x94, 0xAA, 0x94, 0x88, 0x80 },  // G_RIGHT_GUILLEMET
+};
+
+// ASCII to PETSCII translation table entries
+#define DROP  0x00  ///< Character is not printed
+#define G_DOUBLE_QUOTES  1  ///< " glyph
+#define G_SINGLE_QUOTE   2  ///< ' glyph
+#define G_BACKSLASH      3  ///< Backslash glyph
+#define G_GRAVE_ACCENT   4  ///< ` glyph
+#define G_OPEN_BRACE     5  ///< { glyph
+#define G_CLOSE_BRACE    6  ///< } glyph
+#define G_TILDE          7  ///< ~ glyph
+#define G_HAT            8  ///< ^ glyph
+#define G_VERTICAL_BAR   9  ///< | glyph
+#define G_A_UMLAUT_SMALL  10  ///< a umlaut glyph
+#define G_O_UMLAUT_SMALL  11  ///< o umlaut glyph
+#define G_U_UMLAUT_SMALL  12  ///< u umlaut glyph
+#define G_A_UMLAUT        13  ///< A umlaut glyph
+#define G_O_UMLAUT        14  ///< O umlaut glyph
+#define G_U_UMLAUT        15  ///< U umlaut glyph
+#define G_SHARP_S         16  ///< Sharp s glyph
+#define G_E_ACUTE         17  ///< e acute glyph
+#define G_E_GRAVE         18  ///< e grave glyph
+#define G_A_GRAVE         19  ///< a grave glyph
+#define G_C_CEDILLA       20  ///< c cedilla glyph
+#define G_N_TILDE         21  ///< n tilde glyph
+#define G_DEGREE          22  ///< Degree sign glyph
+#define G_EURO            23  ///< Euro sign glyph
+#define G_SECTION         24  ///< Section sign glyph
+#define G_PLUS_MINUS      25  ///< Plus-minus sign glyph
+#define G_MICRO           26  ///< Micro sign glyph
+#define G_TIMES           27  ///< Multiplication sign glyph
+#define G_DIVIDE          28  ///< Division sign glyph
+#define G_ELLIPSIS        29  ///< Ellipsis glyph
+#define G_LEFT_GUILLEMET  30  ///< Left guillemet glyph
+#define G_RIGHT_GUILLEMET 31  ///< Right guillemet glyph
+
+/// ASCII to PETSCII translation table, indexed by ASCII code.
+/// Entry is a PETSCII code, a glyph number (1 to GLYPH_ASCII) or DROP.
+/// PETSCII codes 0x00 to 0x09 are never sent in ASCII mode, so they
+/// are free to encode DROP and glyph numbers.
+static const uint8_t AsciiTable[256] PROGMEM = {
+  /* 0x00 */ DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, 0x0A, DROP, DROP, 0x0D, DROP, DROP,
+  /* 0x10 */ DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP,
+  /* 0x20 */ 0x20, 0x21, G_DOUBLE_QUOTES, 0x23, 0x24, 0x25, 0x26, G_SINGLE_QUOTE, 0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F,
+  /* 0x30 */ 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F,
+  /* 0x40 */ 0x40, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F,
+  /* 0x50 */ 0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x5B, G_BACKSLASH, 0x5D, G_HAT, PETSCII_UNDERSCORE,
+  /* 0x60 */ G_GRAVE_ACCENT, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F,
+  /* 0x70 */ 0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, G_OPEN_BRACE, G_VERTICAL_BAR, G_CLOSE_BRACE, G_TILDE, 0x7F,
+  /* 0x80 */ DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP,
+  /* 0x90 */ DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP, DROP,
+  /* 0xA0 */ 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF,
+  /* 0xB0 */ 0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF,
+  /* 0xC0 */ 0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xCB, 0xCC, 0xCD, 0xCE, 0xCF,
+  /* 0xD0 */ 0xD0, 0xD1, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE, 0xDF,
+  /* 0xE0 */ 0xE0, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xEB, 0xEC, 0xED, 0xEE, 0xEF,
+  /* 0xF0 */ 0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF
+};
+
+/// UTF-8 character translation entry
+struct Utf8Char {
+  uint16_t codepoint;  ///< Unicode code point
+  uint8_t code;        ///< PETSCII code, or glyph number below 0x20
+};
+
+/// UTF-8 to PETSCII translation table, sorted by code point. Accented letters
+/// without a glyph print as their base letter, the others are dropped.
+static const Utf8Char Utf8Table[] PROGMEM = {
+  // Latin-1 symbols
+  { 0x00A0, 0x20 }, { 0x00A3, 0x5C }, { 0x00A7, G_SECTION }, { 0x00AB, G_LEFT_GUILLEMET },
+  { 0x00B0, G_DEGREE }, { 0x00B1, G_PLUS_MINUS }, { 0x00B4, G_SINGLE_QUOTE }, { 0x00B5, G_MICRO },
+  { 0x00BB, G_RIGHT_GUILLEMET },
+  // Latin-1 capital letters
+  { 0x00C0, 0x61 }, { 0x00C1, 0x61 }, { 0x00C2, 0x61 }, { 0x00C3, 0x61 }, { 0x00C4, G_A_UMLAUT },
+  { 0x00C5, 0x61 }, { 0x00C7, 0x63 }, { 0x00C8, 0x65 }, { 0x00C9, 0x65 }, { 0x00CA, 0x65 }, { 0x00CB, 0x65 },
+  { 0x00CC, 0x69 }, { 0x00CD, 0x69 }, { 0x00CE, 0x69 }, { 0x00CF, 0x69 }, { 0x00D1, 0x6E }, { 0x00D2, 0x6F },
+  { 0x00D3, 0x6F }, { 0x00D4, 0x6F }, { 0x00D5, 0x6F }, { 0x00D6, G_O_UMLAUT }, { 0x00D7, G_TIMES },
+  { 0x00D8, 0x6F }, { 0x00D9, 0x75 }, { 0x00DA, 0x75 }, { 0x00DB, 0x75 }, { 0x00DC, G_U_UMLAUT },
+  { 0x00DD, 0x79 }, { 0x00DF, G_SHARP_S },
+  // Latin-1 small letters
+  { 0x00E0, G_A_GRAVE }, { 0x00E1, 0x41 }, { 0x00E2, 0x41 }, { 0x00E3, 0x41 }, { 0x00E4, G_A_UMLAUT_SMALL },
+  { 0x00E5, 0x41 }, { 0x00E7, G_C_CEDILLA }, { 0x00E8, G_E_GRAVE }, { 0x00E9, G_E_ACUTE }, { 0x00EA, 0x45 },
+  { 0x00EB, 0x45 }, { 0x00EC, 0x49 }, { 0x00ED, 0x49 }, { 0x00EE, 0x49 }, { 0x00EF, 0x49 },
+  { 0x00F1, G_N_TILDE }, { 0x00F2, 0x4F }, { 0x00F3, 0x4F }, { 0x00F4, 0x4F }, { 0x00F5, 0x4F },
+  { 0x00F6, G_O_UMLAUT_SMALL }, { 0x00F7, G_DIVIDE }, { 0x00F8, 0x4F }, { 0x00F9, 0x55 }, { 0x00FA, 0x55 },
+  { 0x00FB, 0x55 }, { 0x00FC, G_U_UMLAUT_SMALL }, { 0x00FD, 0x59 }, { 0x00FF, 0x59 },
+  // Punctuation
+  { 0x2010, 0x2D }, { 0x2011, 0x2D }, { 0x2013, 0x2D }, { 0x2014, 0x2D }, { 0x2018, G_SINGLE_QUOTE },
+  { 0x2019, G_SINGLE_QUOTE }, { 0x201C, G_DOUBLE_QUOTES }, { 0x201D, G_DOUBLE_QUOTES },
+  { 0x2026, G_ELLIPSIS }, { 0x20AC, G_EURO },
+  // Arrows
+  { 0x2190, 0x5F }, { 0x2191, 0x5E },
+  // Box drawing
+  { 0x2500, 0xC0 }, { 0x2502, 0xDD }, { 0x250C, 0xB0 }, { 0x2510, 0xAE }, { 0x2514, 0xAD }, { 0x2518, 0xBD },
+  { 0x251C, 0xAB }, { 0x2524, 0xB3 }, { 0x252C, 0xB2 }, { 0x2534, 0xB1 }, { 0x253C, 0xDB },
+  // Block elements
+  { 0x2581, PETSCII_UNDERSCORE }, { 0x2584, 0xA2 }, { 0x258C, 0xA1 }, { 0x258F, 0xA5 }, { 0x2592, 0xA6 },
+  { 0x2594, 0xA3 }, { 0x2595, 0xA7 }, { 0x2596, 0xBB }, { 0x2597, 0xAC }, { 0x2598, 0xBE }, { 0x259A, 0xBF },
+  { 0x259D, 0xBC }
+};
+#define UTF8_COUNT  (sizeof(Utf8Table) / sizeof(Utf8Table[0]))  ///< Utf8Table entries
+
+/// Settings changed by the host, stored in EEPROM
+struct Settings {
+  uint8_t pad;              ///< Primary Address
+  uint8_t sad;              ///< Secondary Address
+  uint8_t mode;             ///< JOB_ASCII and JOB_MIRROR mode flags
+  uint8_t flow;             ///< Serial flow control mode
+  uint8_t timing;           ///< IEC timing profile, TIMING_TUNED or TIMING_FIXED
+  uint8_t start;            ///< Print start policy
+  uint32_t baudrate;        ///< Serial baud rate, 0 detects it at startup
+  uint16_t timeout;         ///< Serial input idle time [ms] before sending queued data
+  uint16_t sessionTimeout;  ///< Serial input idle time [ms] before ending a print job
+};
+static const Settings SettingsDefault = {
+  PAD, SAD_GRAPH, JOB_PETSCII, UsbSerial::FLOW_NONE, TIMING_TUNED, START_POLICY, 0, TIMEOUT, SESSION_TIMEOUT
+};
 
 //-----------------------------------------------
 // Global variables/objects
 //-----------------------------------------------
 
-// IEC serial bus interface
-IecSerial iec(IEC_SRQ, IEC_ATN, IEC_CLK, IEC_DIO, IEC_RST);
+// IEC serial bus interface, pins fixed at compile time
+IecSerialT<IEC_SRQ, IEC_ATN, IEC_CLK, IEC_DIO, IEC_RST> iec;
 
 // Settings
 uint8_t pad = PAD;        ///< Primary Address
 uint8_t sad = SAD_GRAPH;  ///< Secondary Address
 bool asciiMode = false;   ///< ASCII translation mode
+uint8_t flow = UsbSerial::FLOW_NONE;  ///< Serial flow control mode
+bool mirror = false;      ///< Print on both printers PAD and PAD_ALT
+Settings settings = SettingsDefault;  ///< Settings changed by the host
+bool hostSettings = false;  ///< Device, mode and flow control set by the host, else by the switches
+
+// Print session
+bool session = false;     ///< Printer is listening
+bool businessMode = false;  ///< Business mode already set in this session
+uint8_t busResets = 0;    ///< Bus resets done in this session
+uint8_t resetCause = 0;   ///< MCU reset flags at startup
+bool skipping = false;    ///< Printer offline, job data is discarded
+
+// Statistics
+uint32_t droppedBytes = 0;   ///< ASCII characters not printable, dropped
+uint32_t sessionTime = 0;    ///< Time in print sessions [ms]
+uint32_t inputWait = 0;      ///< Time in print sessions with bus idle and no input [ms]
+unsigned long loopTime = 0;  ///< Last main loop pass time [ms]
+size_t rxSeen = 0;           ///< Serial input queue count when the loop last woke up
 
-// Serial input buffer
-char buffer[BUFFER_SIZE];  ///< Serial input buffer
-int bytesReceived = 0;     ///< Serial input buffer byte count
+// Device status
+uint32_t polledDevices = DEVICE_BIT(PAD) | DEVICE_BIT(PAD_ALT);  ///< Devices polled while idle
+uint32_t offlineDevices = 0;  ///< Devices found offline
+uint8_t pollDevice = PAD;     ///< Last polled device
+unsigned long pollTime = 0;   ///< Last poll time [ms]
+
+// Staging buffer between translation and IEC transmission
+uint8_t stage[STAGE_SIZE];  ///< Translated bytes waiting for the bus
+uint8_t stageHead = 0;      ///< First staged byte not yet queued for transmission
+uint8_t stageTail = 0;      ///< End of staged bytes
+
+// ASCII line formatter between receive and translation
+uint8_t lineColumn = 0;   ///< Characters sent on the current printer line
+uint8_t heldBlanks = 0;   ///< Blanks after the last word, dropped at a line end
+uint8_t blanksOut = 0;    ///< Held blanks being sent ahead of a word
+uint8_t wordLeft = 0;     ///< Characters left of the word being sent
+bool lineEndCR = false;   ///< Last byte ended a line with CR, a LF following it is dropped
+
+// Custom glyphs, columns kept in EEPROM
+uint8_t glyphCodes[GLYPH_CACHE];  ///< ASCII code of each custom glyph, GLYPH_FREE if unused
+
+// UTF-8 decoder, in ASCII translation
+uint8_t utf8Held[UTF8_HELD + 1];  ///< Bytes of the character being decoded
+uint8_t utf8Count = 0;    ///< Bytes held
+uint8_t utf8Length = 0;   ///< Character length in bytes, 0 if none is being decoded
+
+// Bit image repeat encoder between translation and staging buffer
+bool imageMode = false;     ///< Printer data is in bit image mode
+bool imageEndHeld = false;  ///< Bit image end held back, dropped if an image begins again
+uint8_t imageArgs = 0;      ///< Bytes left of a received repeat command, passed unchanged
+uint8_t repeatColumn = 0;   ///< Bit image column of the pending run
+uint8_t repeatCount = 0;    ///< Length of the pending column run
+
+// Raster image parser
+#define RASTER_MAGIC   0  ///< Waiting PBM magic number 'P'
+#define RASTER_FORMAT  1  ///< Waiting PBM raw format '4'
+#define RASTER_WIDTH   2  ///< Reading image width
+#define RASTER_HEIGHT  3  ///< Reading image height
+bool rasterMode = false;     ///< Job data is PBM raster images
+bool escapedMode = false;    ///< Job data has JOB_ESCAPE in front of marker values
+bool escapeHeld = false;     ///< A JOB_ESCAPE was read, the next byte is data
+uint8_t rasterState = RASTER_MAGIC;  ///< Raster header parser state
+bool rasterComment = false;  ///< Skipping a header comment line
+bool rasterDigits = false;   ///< Header number has digits
+uint16_t rasterNumber = 0;   ///< Header number being read
+uint16_t rasterWidth = 0;    ///< Image width in dots
+uint16_t rasterRowBytes = 0; ///< Packed raster row size
+uint16_t rasterColumn = 0;   ///< Next row byte of the band to transpose
+uint32_t rasterLeft = 0;     ///< Image bytes not yet printed
+bool rasterDiscard = false;  ///< Image is not printed
+
+// Serial interface with input queue filled by interrupt
+uint8_t rxStorage[BUFFER_SIZE];       ///< Serial input queue storage
+UsbSerial usb(rxStorage, BUFFER_SIZE); ///< USB serial interface
+
+// Spool on external storage
+#if SPOOL_TYPE == SPOOL_SRAM
+SramSpool spoolDevice(SPOOL_CS);
+Spool* spool = &spoolDevice;  ///< Spool backend
+#elif SPOOL_TYPE == SPOOL_SD
+SdSpool spoolDevice(SPOOL_CS);
+Spool* spool = &spoolDevice;  ///< Spool backend
+#else
+Spool* spool = 0;             ///< Spool backend
+#endif
+bool spoolReady = false;  ///< Spool backend found
+bool spooling = false;    ///< Print data goes through the spool
+uint8_t cacheStorage[SPOOL_CACHE];  ///< Spool read cache storage
+RingBuffer spoolCache(cacheStorage, SPOOL_CACHE);  ///< Spool data read back for printing
 
 //-----------------------------------------------
 // Functions
@@ -112,32 +549,94 @@ int bytesReceived = 0;     ///< Serial input buffer byte count
 
 /// Send greating message to the serial interface
 void Greatings() {
-  Serial.println(F("**** USB-IEC SERIAL PRINTER INTERFACE V1 ****"));
+  usb.println(F("**** USB-IEC SERIAL PRINTER INTERFACE V1 ****"));
+#ifdef BOARD_AVR
+  if (resetCause & _BV(WDRF)) {
+    usb.println(F("Watchdog reset"));
+  }
+#endif
 
-  Serial.print(F("Device Address = "));
-  Serial.print(pad);
-  Serial.print(F(","));
-  Serial.print(sad);
-  Serial.print(F(" ("));
+  usb.print(F("Device Address = "));
+  if (mirror) {
+    usb.print(PAD);
+    usb.print(F("+"));
+    usb.print(PAD_ALT);
+  } else {
+    usb.print(pad);
+  }
+  usb.print(F(","));
+  usb.print(sad);
+  usb.print(F(" ("));
 
-  if (digitalRead(SW_ASCII) == LOW) {
+  if (asciiMode) {
     // ASCII mode overides PETSCII Graphic or Business modes
-    Serial.print(F("ASCII"));
+    usb.print(F("ASCII"));
   } else {
     if (sad == SAD_GRAPH) {
-      Serial.print(F("PETSCII Graphic"));
+      usb.print(F("PETSCII Graphic"));
     } else {
-      Serial.print(F("PETSCII Business"));
+      usb.print(F("PETSCII Business"));
     }
   }
 
-  Serial.print(F(" mode)\nBuffer = "));
-  Serial.print(BUFFER_SIZE);
-  Serial.println(F(" bytes"));
+  usb.print(F(" mode)\nSerial = "));
+  usb.print(usb.Baudrate());
+  usb.print(F(" bauds, buffer = "));
+  usb.print(BUFFER_SIZE);
+  usb.print(F(" bytes, "));
+  if (spooling) {
+    usb.print(F("spool = "));
+    usb.print(spool->Capacity());
+    usb.print(F(" bytes, "));
+  }
+
+  if (flow == UsbSerial::FLOW_XONXOFF) {
+    usb.println(F("XON/XOFF"));
+  } else if (flow == UsbSerial::FLOW_RTSCTS) {
+    usb.println(F("RTS/CTS"));
+  } else {
+    usb.println(F("no flow control"));
+  }
+
+  usb.print(F("Start = "));
+  if (settings.start == START_LINE) {
+    usb.print(F("line end"));
+  } else if (settings.start == START_QUEUED) {
+    usb.print(START_LOW);
+    usb.print(F(" bytes"));
+  } else if (settings.start == START_NOW) {
+    usb.print(F("first byte"));
+  } else {
+    usb.print(F("idle"));
+  }
+  usb.print(F(", timeout = "));
+  usb.print(settings.timeout);
+  usb.print(F(" ms, job end = "));
+  usb.print(settings.sessionTimeout);
+  usb.print(settings.timing == TIMING_FIXED ? F(" ms, fixed timing, ") : F(" ms, tuned timing, "));
+  usb.println(hostSettings ? F("host settings") : F("switch settings"));
 }
 
-/// Read Configuration Switches
+/// Read Configuration Switches, or apply the host settings in their place
 void ReadSettings() {
+  if (hostSettings) {
+    pad = settings.pad;
+    sad = settings.sad;
+    asciiMode = (settings.mode & JOB_ASCII);
+    mirror = (settings.mode & JOB_MIRROR);
+    flow = settings.flow;
+  } else {
+    ReadSwitches();
+  }
+  usb.SetFlowControl(flow, USB_CTS);
+  // Get spool setting, changed only while no data is queued
+  if (InAvailable() == 0) {
+    spooling = spoolReady && (digitalRead(SW_SPOOL) == LOW);
+  }
+}
+
+/// Read device, mode and flow control configuration switches
+void ReadSwitches() {
   // Get Primary Address setting
   pad = PAD;
   if (digitalRead(SW_PAD) == LOW) {
@@ -150,104 +649,1277 @@ void ReadSettings() {
   }
   // Get ASCII translation setting
   asciiMode = (digitalRead(SW_ASCII) == LOW);
+  // Get mirror setting
+  mirror = (digitalRead(SW_MIRROR) == LOW);
+  // Get flow control setting. XON/XOFF overides RTS/CTS
+  flow = UsbSerial::FLOW_NONE;
+  if (digitalRead(SW_XON) == LOW) {
+    flow = UsbSerial::FLOW_XONXOFF;
+  } else if (digitalRead(SW_RTS) == LOW) {
+    flow = UsbSerial::FLOW_RTSCTS;
+  }
 }
 
-/// Print buffer contents to IEC device
-void PrintBuffer() {
-  // Command Printer to Listen
-  if (!iec.Listen(pad, sad)) {
-    // Printer not found error
-    Serial.println(F("IEC device not found"));
+/// Use settings stored in EEPROM, if any
+void LoadSettings() {
+  if (EEPROM.read(EEPROM_SETTINGS) == SETTINGS_VALID) {
+    EEPROM.get(EEPROM_SETTINGS + 1, settings);
+    hostSettings = true;
+  }
+}
+
+/// Change a setting from a set setting command, read from the input.
+/// The first setting changed takes the others from the switches.
+/// @param key is the setting name
+void SetSetting(uint8_t key) {
+  uint32_t value = 0;
+  for (uint8_t i = SETTING_VALUE_SIZE; i > 0; i--) {
+    value = (value << 8) | InPeek(JOB_HEADER_SIZE + i - 1);
+  }
+  if (!hostSettings) {
+    ReadSwitches();
+    settings.pad = pad;
+    settings.sad = sad;
+    settings.mode = (asciiMode ? JOB_ASCII : 0) | (mirror ? JOB_MIRROR : 0);
+    settings.flow = flow;
+    settings.baudrate = usb.Baudrate();
+  }
+  if (key == SETTING_PAD && value >= PAD && value <= PAD_LAST) {
+    settings.pad = value;
+    polledDevices |= DEVICE_BIT(value);
+  } else if (key == SETTING_SAD && value <= 0x0F) {
+    settings.sad = value;
+  } else if (key == SETTING_MODE && (value & ~(JOB_ASCII | JOB_MIRROR)) == 0) {
+    settings.mode = value;
+  } else if (key == SETTING_FLOW && value <= UsbSerial::FLOW_RTSCTS) {
+    settings.flow = value;
+  } else if (key == SETTING_BAUD && (value == 0 || UsbSerial::isStandardRate(value))) {
+    settings.baudrate = value;
+  } else if (key == SETTING_TIMEOUT && value > 0 && value <= 0xFFFF) {
+    settings.timeout = value;
+  } else if (key == SETTING_SESSION && value > 0 && value <= 0xFFFF) {
+    settings.sessionTimeout = value;
+  } else if (key == SETTING_TIMING && value <= TIMING_FIXED) {
+    settings.timing = value;
+  } else if (key == SETTING_START && value <= START_NOW) {
+    settings.start = value;
+  } else {
+    usb.println(F("Setting not valid"));
     return;
   }
+  hostSettings = true;
+  ReadSettings();
+  if (key == SETTING_BAUD && value != 0 && value != usb.Baudrate()) {
+    usb.Begin(value);  // host follows after this command
+  }
+}
 
-  // Send buffered data to printer
-  bool ok = true;
-  if (asciiMode) {
-    // Send translated ASCII
-    ok = SendAscii();
+/// Report, store or erase the settings from a settings command
+/// @param argument is SETTINGS_REPORT, SETTINGS_SAVE or SETTINGS_ERASE
+void StoreSettings(uint8_t argument) {
+  if (argument == SETTINGS_SAVE && hostSettings) {
+    EEPROM.put(EEPROM_SETTINGS + 1, settings);
+    EepromWrite(EEPROM_SETTINGS, SETTINGS_VALID);
+    EepromCommit();
+  } else if (argument == SETTINGS_ERASE) {
+    EepromWrite(EEPROM_SETTINGS, 0);
+    EepromCommit();
+    settings = SettingsDefault;
+    hostSettings = false;
+    ReadSettings();
+  } else if (argument != SETTINGS_REPORT) {
+    return;
+  }
+  Greatings();
+}
+
+/// Write an EEPROM byte, only if changed on MCU EEPROM
+/// @param address is the EEPROM address
+/// @param value is the byte to write
+void EepromWrite(int address, uint8_t value) {
+#if EEPROM_EMULATED
+  EEPROM.write(address, value);
+#else
+  EEPROM.update(address, value);
+#endif
+}
+
+/// Store EEPROM writes in flash, on boards emulating EEPROM
+void EepromCommit() {
+#if EEPROM_EMULATED
+  EEPROM.commit();
+#endif
+}
+
+/// EEPROM address of timing profile for current device
+int TimingAddress() {
+  uint8_t slot = mirror ? TIMING_MIRROR : pad;
+  return EEPROM_TIMING + slot * (1 + sizeof(IecTiming));
+}
+
+/// Use stored timing profile of current device or calibrate a new one
+void LoadTiming() {
+  int address = TimingAddress();
+  if (settings.timing == TIMING_FIXED) {
+    iec.SetTiming(IecBus::TimingConservative);
+  } else if (EEPROM.read(address) == TIMING_VALID) {
+    IecTiming timing;
+    EEPROM.get(address + 1, timing);
+    iec.SetTiming(timing);
   } else {
-    // Send unchanged PETSCII
-    ok = iec.Send(buffer, bytesReceived, true);
+    iec.Calibrate(CALIBRATION_BYTES);
   }
+}
 
-  // Report if error
-  if (!ok) {
-    Serial.println(F("IEC listen error"));
+/// Store and report timing profile of current device if it has changed.
+/// A fallback after a framing error is not stored: the stored profile is
+/// dropped so the next session calibrates again.
+void SaveTiming() {
+  if (iec.isCalibrating() || settings.timing == TIMING_FIXED) {
+    return;  // not enough bytes sent, or not tuned
+  }
+  int address = TimingAddress();
+  if (iec.isFallback()) {
+    if (EEPROM.read(address) == TIMING_VALID) {
+      EepromWrite(address, 0);
+      EepromCommit();
+      usb.print(F("IEC timing "));
+      usb.print(pad);
+      usb.println(F(" dropped, calibrates next session"));
+    }
+    return;
+  }
+  IecTiming stored;
+  EEPROM.get(address + 1, stored);
+  if (EEPROM.read(address) == TIMING_VALID &&
+      memcmp(&stored, &iec.Timing(), sizeof(IecTiming)) == 0) {
+    return;  // no change
   }
+  EEPROM.put(address + 1, iec.Timing());
+  EepromWrite(address, TIMING_VALID);
+  EepromCommit();
+
+  // Report new timing
+  usb.print(F("IEC timing "));
+  usb.print(pad);
+  usb.print(iec.isConservative() ? F(" conservative: Tne=") : F(" tuned: Tne="));
+  usb.print(iec.Timing().tne);
+  usb.print(F(" Ts="));
+  usb.print(iec.Timing().ts);
+  usb.print(F(" Tv="));
+  usb.print(iec.Timing().tv);
+  usb.print(F(" Tbb="));
+  usb.print(iec.Timing().tbb);
+  usb.print(F(" us (max RFD "));
+  usb.print(iec.MaxReadyTime());
+  usb.print(F(" us, max DA "));
+  usb.print(iec.MaxAcceptTime());
+  usb.println(F(" us)"));
+}
+
+/// Check if a device was not found offline by the last status poll or listen
+/// @param device is the device address
+bool isOnline(uint8_t device) {
+  return !(offlineDevices & DEVICE_BIT(device));
+}
 
-  // Command all devices to Unlisten
+/// Record a device status, reporting changes
+/// @param device is the device address
+/// @param online is the new device status
+/// @param *message is the device status message, empty if none
+void SetOnline(uint8_t device, bool online, const char* message) {
+  if (online == isOnline(device)) {
+    return;  // no change
+  }
+  if (online) {
+    offlineDevices &= ~DEVICE_BIT(device);
+  } else {
+    offlineDevices |= DEVICE_BIT(device);
+  }
+  usb.print(F("IEC device "));
+  usb.print(device);
+  usb.print(online ? F(" online") : F(" offline"));
+  if (message[0] != '\0') {
+    usb.print(F(": "));
+    usb.print(message);
+  }
+  usb.println();
+}
+
+/// Read a device status on its status channel.
+/// A device that talks, like a printer bridge, answers a "code,message"
+/// line: codes from STATUS_ERROR up are errors. A listen only printer
+/// does not talk and is online if it listens when commanded to.
+/// @param device is the device address
+void PollDevice(uint8_t device) {
+  char message[STATUS_SIZE] = "";
+  bool online;
+  if (iec.Talk(device, SAD_STATUS)) {
+    online = iec.Get(message, STATUS_SIZE) && atoi(message) < STATUS_ERROR;
+    iec.Untalk();
+  } else {
+    if (iec.Status() != IecBus::STATUS_NO_DEVICE) {
+      iec.Untalk();
+    }
+    online = iec.Listen(device);
+    if (online) {
+      iec.Unlisten();
+    }
+  }
+  SetOnline(device, online, message);
+}
+
+/// Poll the status of the next printer every POLL_INTERVAL while idle
+void PollDevices() {
+  if (millis() - pollTime < POLL_INTERVAL) {
+    return;
+  }
+  pollTime = millis();
+  do {
+    pollDevice = (pollDevice < PAD_LAST) ? pollDevice + 1 : 0;
+  } while (!(polledDevices & DEVICE_BIT(pollDevice)));
+  PollDevice(pollDevice);
+}
+
+/// Command current printer, or both printers in mirror mode, to Listen.
+/// Printers found offline are tried again, a missing one costs the ATN timeout.
+/// In mirror mode each printer is checked on its own, the job prints on
+/// those present.
+/// @return true if OK, false if printer offline or not found
+bool ListenPrinter() {
+  if (mirror) {
+    static const uint8_t pair[2] = { PAD, PAD_ALT };
+    uint8_t devices[2];
+    size_t count = 0;
+    for (uint8_t i = 0; i < 2; i++) {
+      bool online = iec.Listen(pair[i], sad);
+      if (online) {
+        iec.Unlisten();
+        devices[count++] = pair[i];
+      }
+      SetOnline(pair[i], online, "");
+    }
+    // Listeners found in a single ATN sequence, each byte is sent once
+    return (count > 0 && iec.Listen(devices, count, sad));
+  }
+  bool online = iec.Listen(pad, sad);
+  SetOnline(pad, online, "");
+  return online;
+}
+
+/// Command printer to Listen, or discard the job data if printer is offline
+void StartPrinter() {
+  skipping = !ListenPrinter();
+  if (skipping) {
+    usb.println(F("IEC device not found, job skipped"));
+  }
+}
+
+/// Open a print session: read settings and command printer to Listen
+void OpenSession() {
+  // Read user settings before printing, a leading job header overides them
+  ReadSettings();
+  if (InPeek(0) == JOB_START && InBuffered() >= JOB_HEADER_SIZE) {
+    ReadJobHeader(pad, sad, asciiMode, mirror, rasterMode, escapedMode);
+  }
+  LoadTiming();
+  businessMode = false;
+  busResets = 0;
+  // Command Printer to Listen
+  StartPrinter();
+  session = true;
+}
+
+/// Check if queued data starts a print session, by the start policy setting
+/// @param queued is the number of bytes waiting
+/// @return true on a half full queue, after an input pause or as the policy says
+bool isStartDue(uint32_t queued) {
+  if (queued >= START_LEVEL || usb.Idle() >= settings.timeout) {
+    return true;
+  }
+  // Wait a whole job header, interface commands run when complete
+  size_t buffered = InBuffered();
+  if (buffered > 0 && InPeek(0) == JOB_START &&
+      (buffered < JOB_HEADER_SIZE || InPeek(1) == INTERFACE_DEVICE)) {
+    return false;
+  }
+  if (settings.start == START_LINE) {
+    // Newest received byte, also when it was already moved to the spool
+    uint8_t c = usb.LastByte();
+    return (c == CR || c == LF);
+  }
+  if (settings.start == START_QUEUED) {
+    return (queued >= START_LOW);
+  }
+  return (settings.start == START_NOW);
+}
+
+/// Close the print session: send staged bytes, last one with EOI, and Unlisten
+void CloseSession() {
+  if (!skipping && !FinishOutput()) {
+    usb.println(F("IEC listen error"));
+  }
+  EndSession();
+}
+
+/// Send staged bytes, last one with EOI, and wait background transmission.
+/// Recovers from bus errors.
+/// @return true if OK, false if error
+bool FinishOutput() {
+  bool ok = OutputStage(true) && FlushBus();
+  while (!ok && RecoverBus()) {
+    ok = OutputStage(true) && FlushBus();
+  }
+  return ok;
+}
+
+/// Wait background transmission, feeding the watchdog
+/// @return true if OK, false if error
+bool FlushBus() {
+  while (iec.TxBusy()) {
+    wdt_reset();
+  }
+  return iec.isOk();
+}
+
+/// Report a bus error and try to recover with a bus reset. The printer
+/// is commanded to listen again and the failed byte is sent again.
+/// @return true if printing can go on, false if session must be aborted
+bool RecoverBus() {
+  usb.print(F("IEC bus error 0x"));
+  usb.println(iec.Status(), HEX);
+  if (busResets >= BUS_RETRIES) {
+    return false;
+  }
+  busResets++;
+  wdt_reset();
+  if (!iec.Recover()) {
+    return false;
+  }
+  businessMode = false;  // printer back to its power on mode
+  usb.println(F("IEC bus reset"));
+  return true;
+}
+
+/// Check for a complete interface command at the input start
+bool isCommand() {
+  return InBuffered() >= JOB_HEADER_SIZE && InPeek(0) == JOB_START &&
+         InPeek(1) == INTERFACE_DEVICE && InBuffered() >= CommandSize();
+}
+
+/// Size of the interface command at the input start, header and data
+/// @return bytes, the header must be buffered
+size_t CommandSize() {
+  if (InPeek(2) == LOAD_GLYPH && InPeek(3) != 0) {
+    return JOB_HEADER_SIZE + GLYPH_COLUMNS;
+  }
+  if (InPeek(2) == SET_SETTING) {
+    return JOB_HEADER_SIZE + SETTING_VALUE_SIZE;
+  }
+  return JOB_HEADER_SIZE;
+}
+
+/// Run and remove the interface command at the input start
+void RunCommand() {
+  uint8_t command = InPeek(2);
+  uint8_t argument = InPeek(3);
+  if (command == QUERY_STATS) {
+    ReportStats();
+    if (argument & 1) {
+      ClearStats();
+    }
+  } else if (command == LOAD_GLYPH) {
+    LoadGlyph(argument);
+  } else if (command == SET_SETTING) {
+    SetSetting(argument);
+  } else if (command == SETTINGS) {
+    StoreSettings(argument);
+  }
+  InConsume(CommandSize());
+}
+
+/// Store the custom glyph of a load glyph command, read from the input.
+/// A glyph already loaded for the code is replaced.
+/// @param code is the ASCII code printed as the glyph, 0 clears all custom glyphs
+void LoadGlyph(uint8_t code) {
+  if (code == 0) {
+    for (uint8_t slot = 0; slot < GLYPH_CACHE; slot++) {
+      glyphCodes[slot] = GLYPH_FREE;
+      EepromWrite(GlyphAddress(slot), GLYPH_FREE);
+    }
+    EepromCommit();
+    return;
+  }
+  if (code == GLYPH_FREE || !isWordChar(code, false)) {
+    usb.println(F("Glyph code not printable"));
+    return;
+  }
+  uint8_t slot = 0;
+  while (slot < GLYPH_CACHE && glyphCodes[slot] != code) {
+    slot++;
+  }
+  if (slot == GLYPH_CACHE) {
+    slot = 0;
+    while (slot < GLYPH_CACHE && glyphCodes[slot] != GLYPH_FREE) {
+      slot++;
+    }
+  }
+  if (slot == GLYPH_CACHE) {
+    usb.println(F("Glyph cache full"));
+    return;
+  }
+  int address = GlyphAddress(slot);
+  for (uint8_t i = 0; i < GLYPH_COLUMNS; i++) {
+    EepromWrite(address + 1 + i, InPeek(JOB_HEADER_SIZE + i) | IMAGE_COLUMN);
+  }
+  glyphCodes[slot] = code;
+  EepromWrite(address, code);
+  EepromCommit();
+}
+
+/// EEPROM address of a custom glyph: code byte, then its columns
+/// @param slot is the custom glyph, 0 to GLYPH_CACHE-1
+int GlyphAddress(uint8_t slot) {
+  return EEPROM_GLYPHS + slot * (1 + GLYPH_COLUMNS);
+}
+
+/// Read the codes of custom glyphs stored in EEPROM
+void LoadGlyphs() {
+  for (uint8_t slot = 0; slot < GLYPH_CACHE; slot++) {
+    glyphCodes[slot] = EEPROM.read(GlyphAddress(slot));
+  }
+}
+
+/// Report a handshake time histogram, non empty buckets as lower bound:count
+/// @param name is the histogram name
+/// @param histogram[] is the histogram
+void ReportHistogram(const __FlashStringHelper* name, const uint16_t histogram[]) {
+  usb.print(name);
+  usb.print(F(" us"));
+  for (uint8_t i = 0; i < IecStats::BUCKETS; i++) {
+    if (histogram[i] > 0) {
+      usb.print(F(" "));
+      usb.print(i == 0 ? 0 : 1UL << i);
+      usb.print(F(":"));
+      usb.print(histogram[i]);
+    }
+  }
+  usb.println();
+}
+
+/// Report bus statistics: a slow job with long Ready for Data waits is
+/// bound by printer mechanics, with long input waits by the host link
+void ReportStats() {
+  const IecStats& stats = iec.Stats();
+  usb.print(F("IEC bytes="));
+  usb.print(stats.bytes);
+  usb.print(F(" framing errors="));
+  usb.print(stats.framingErrors);
+  usb.print(F(" bus resets="));
+  usb.println(iec.Recoveries());
+  ReportHistogram(F("RFD"), stats.ready);
+  ReportHistogram(F("DA"), stats.accept);
+  ReportHistogram(F("EOI"), stats.eoi);
+  ReportHistogram(F("ATN"), stats.command);
+  usb.print(F("USB overruns="));
+  usb.print(usb.Overruns());
+  usb.print(F(" dropped="));
+  usb.print(droppedBytes);
+  usb.print(F(" session ms="));
+  usb.print(sessionTime);
+  usb.print(F(" input wait ms="));
+  usb.println(inputWait);
+}
+
+/// Clear bus statistics
+void ClearStats() {
+  iec.ClearStats();
+  droppedBytes = 0;
+  sessionTime = 0;
+  inputWait = 0;
+}
+
+/// Read and remove the job header at the input start
+/// @param jobPad returns the job device address, unchanged if not valid
+/// @param jobSad returns the job secondary address
+/// @param jobAscii returns the job ASCII translation mode
+/// @param jobMirror returns the job mirror mode
+/// @param jobRaster returns the job raster image mode
+/// @param jobEscaped returns the job escaped data mode
+void ReadJobHeader(uint8_t& jobPad, uint8_t& jobSad, bool& jobAscii, bool& jobMirror, bool& jobRaster, bool& jobEscaped) {
+  uint8_t device = InPeek(1);
+  if (device >= PAD && device <= PAD_LAST) {
+    jobPad = device;
+    polledDevices |= DEVICE_BIT(device);
+  }
+  jobSad = InPeek(2) & 0x0F;
+  uint8_t mode = InPeek(3);
+  jobAscii = (mode & JOB_ASCII);
+  jobMirror = (mode & JOB_MIRROR);
+  jobRaster = (mode & JOB_RASTER);
+  jobEscaped = (mode & JOB_ESCAPED);
+  InConsume(JOB_HEADER_SIZE);
+}
+
+/// Start the next job of the session from its job header. Previous job
+/// ends with EOI and the printer is switched only if the device changes.
+/// Data of a job for an offline printer is discarded.
+void StartJob() {
+  bool ok = OutputStage(true);
+  uint8_t jobPad = pad;
+  uint8_t jobSad;
+  bool jobAscii;
+  bool jobMirror;
+  bool jobRaster;
+  bool jobEscaped;
+  ReadJobHeader(jobPad, jobSad, jobAscii, jobMirror, jobRaster, jobEscaped);
+  if (jobAscii != asciiMode) {
+    businessMode = false;
+  }
+  asciiMode = jobAscii;
+  rasterMode = jobRaster;
+  escapedMode = jobEscaped;
+  RasterReset();
+  utf8Length = 0;
+  if (ok && jobPad == pad && jobSad == sad && jobMirror == mirror) {
+    return;  // same printer, keep listening
+  }
+  // Switch printer, a skipped job has nothing to finish
+  if (!skipping && !FinishOutput()) {
+    usb.println(F("IEC listen error"));
+  }
+  SaveTiming();
   iec.Unlisten();
+  EncodeReset();
+  FormatReset();
+  pad = jobPad;
+  sad = jobSad;
+  mirror = jobMirror;
+  businessMode = false;
+  LoadTiming();
+  StartPrinter();
 }
 
-/// Send buffered data to printer converting to ASCII
-bool SendAscii() {
-  bool ok = true;  // IEC interface status
-  bool eoi = false;  // flag last character for EOI sending
-  for (size_t i = 0; i < bytesReceived; i++) {
-    // Stop on interface error
-    if (!ok) {
-      return ok;
-    }
-    // Detect last byte for EOI
-    eoi = (i == bytesReceived-1);
-    uint8_t c = buffer[i];
-    // Send Translated ASCII to PETSCII codes
-    ok = iec.Send(CMD_BUSINESS);  // always in Business mode
-    switch(c) {
-      case DOUBLE_QUOTES: // ASCII 0x22
-        ok &= iec.Send(DoubleQuotesImg, GLYPH_SIZE, eoi);
-        break;
-      case SINGLE_QUOTE: // ASCII 0x27
-        ok &= iec.Send(SingleQuoteImg, GLYPH_SIZE, eoi);
-        break;
-      case BACKSLASH: // ASCII 0x5C
-        ok &= iec.Send(BackslashImg, GLYPH_SIZE, eoi);
-        break;
-      case '^':  // ASCII 0x5E
-        ok &= iec.Send(HatImg, GLYPH_SIZE, eoi);
-        break;
-      case '_':  // ASCII 0x5F
-        ok &= iec.Send(PETSCII_UNDERSCORE, eoi);
-        break;
-      case GRAVE_ACCENT: // ASCII 0x60
-        ok &= iec.Send(GraveAccentImg, GLYPH_SIZE, eoi);
-        break;
-      case '{':  // ASCII 0x7B
-        ok &= iec.Send(OpenBraceImg, GLYPH_SIZE, eoi);
-        break;
-      case '|':  // ASCII 0x7C
-        ok &= iec.Send(VerticalBarImg, GLYPH_SIZE, eoi);
-        break;
-      case '}':  // ASCII 0x7D
-        ok &= iec.Send(CloseBraceImg, GLYPH_SIZE, eoi);
-        break;
-      case '~':  // ASCII 0x7E
-        ok &= iec.Send(TildeImg, GLYPH_SIZE, eoi);
-        break;
-      case CR : // Carriage Return. No change
-      case LF : // Line Feed. No change
-        ok &= iec.Send(c, eoi);
-        break;
-      default:  // Remaining codes
-        // Translate Uppercase letters
-        if ( c >= 'A' && c <= 'Z' ) {
-          ok &= iec.Send(c + 32, eoi);
-          continue;
-        }
-        // Translate Lowercase letters
-        if ( c >= 'a' && c <= 'z' ) {
-          ok &= iec.Send(c - 32, eoi);
-          continue;
-        }
-        // Send other codes unchanged but avoiding control characters
-        if ((c >= 0x20 && c < 0x80) || c >= 0xA0) {
-          ok &= iec.Send(c, eoi);
+/// Command all devices to Unlisten and end the print session
+void EndSession() {
+  SaveTiming();
+  stageHead = stageTail = 0;
+  EncodeReset();
+  FormatReset();
+  RasterReset();
+  utf8Length = 0;
+  rasterMode = false;
+  escapedMode = false;
+  escapeHeld = false;
+  iec.Unlisten();
+  session = false;
+  skipping = false;
+}
+
+/// Move received data from serial input queue to spool and refill the read cache
+void RunSpool() {
+  const uint8_t* data;
+  size_t length;
+  while ((length = usb.Span(data)) > 0) {
+    size_t n = spool->Write(data, length);
+    usb.Consume(n);
+    if (n < length) {
+      break;  // spool full, serial flow control holds the host
+    }
+  }
+  uint8_t chunk[16];
+  while (!spool->isEmpty() && spoolCache.Free() > 0) {
+    size_t n = spool->Read(chunk, min(spoolCache.Free(), sizeof(chunk)));
+    for (size_t i = 0; i < n; i++) {
+      spoolCache.Put(chunk[i]);
+    }
+  }
+}
+
+/// Contiguous run of print data: spool read cache if spooling, else serial input queue
+/// @param data returns a pointer to the oldest byte
+/// @return run length, zero if nothing buffered
+size_t InSpan(const uint8_t*& data) {
+  return spooling ? spoolCache.Span(data) : usb.Span(data);
+}
+
+/// Remove print data already read in place
+/// @param n is the number of bytes to remove
+void InConsume(size_t n) {
+  if (spooling) {
+    spoolCache.Consume(n);
+  } else {
+    usb.Consume(n);
+  }
+}
+
+/// Return a buffered print data byte without removing it
+/// @param offset is the byte position counted from the oldest one
+uint8_t InPeek(size_t offset) {
+  return spooling ? spoolCache.Peek(offset) : usb.Peek(offset);
+}
+
+/// Number of print data bytes buffered in RAM, available to InSpan() and InPeek()
+size_t InBuffered() {
+  return spooling ? spoolCache.Count() : usb.Available();
+}
+
+/// Number of print data bytes waiting, including spooled data
+uint32_t InAvailable() {
+  uint32_t count = usb.Available();
+  if (spooling) {
+    count += spoolCache.Count() + spool->Count();
+  }
+  return count;
+}
+
+/// Discard all waiting print data
+void FlushInput() {
+  usb.Flush();
+  if (spooling) {
+    spool->Clear();
+    spoolCache.Clear();
+  }
+}
+
+/// Print queued data to listening IEC device until the queue is empty.
+/// Data received while printing is appended to the queue and printed
+/// in the same pass, so a continuous stream runs at printer speed.
+/// Queued data is parsed in place: PETSCII text runs go straight from the
+/// receive queue to the bus, ASCII and bit images go through the staging
+/// buffer and the repeat encoder.
+/// @param last if true the last queued byte is sent with EOI, otherwise
+///             it is held back in queue until known not to be the last one
+void PrintBuffer(bool last) {
+  bool ok = true;
+  const uint8_t* data;
+  size_t length;
+  while (ok && (length = InSpan(data)) > 0) {
+    if (rasterLeft > 0) {
+      // Raster image data, job marker values are dots
+      if (!RasterBand(last)) {
+        break;  // band not buffered or staging buffer full
+      }
+      ok = OutputStage(last && rasterLeft == 0 && InAvailable() == 0);
+      continue;
+    }
+    bool marker = !escapeHeld;  // the byte after JOB_ESCAPE is data
+    if (marker && data[0] == JOB_END && isJobMarker(data[0])) {
+      // End of job marker, not printed
+      InConsume(1);
+      CloseSession();
+      return;
+    }
+    if (marker && escapedMode && data[0] == JOB_ESCAPE) {
+      // Escape, not printed
+      InConsume(1);
+      escapeHeld = true;
+      continue;
+    }
+    if (marker && data[0] == JOB_START && isJobMarker(data[0])) {
+      // Job header or interface command, wait until complete
+      size_t size = JOB_HEADER_SIZE;
+      if (InBuffered() >= JOB_HEADER_SIZE && InPeek(1) == INTERFACE_DEVICE) {
+        size = CommandSize();
+      }
+      if (InBuffered() < size) {
+        if (last && InAvailable() < size) {
+          InConsume(InBuffered());  // truncated header
         }
         break;
+      }
+      if (InPeek(1) == INTERFACE_DEVICE) {
+        RunCommand();
+      } else {
+        StartJob();
+      }
+      continue;
+    }
+    // Run of bytes up to a job marker, an escape or the queue storage end
+    size_t run = 1;
+    while (run < length && !isJobMarker(data[run]) && !(escapedMode && data[run] == JOB_ESCAPE)) {
+      run++;
     }
+    size_t used;
+    if (rasterMode) {
+      used = RasterHeader(data, run);  // image data follows
+    } else if (skipping) {
+      used = run;  // printer offline
+    } else if (asciiMode || imageMode || data[0] == CMD_IMAGE_BEGIN) {
+      used = TranslateRun(data, run, last);
+      ok = OutputStage(last && used == InAvailable());
+    } else {
+      // PETSCII text up to the next bit image
+      size_t text = 1;
+      while (text < run && data[text] != CMD_IMAGE_BEGIN) {
+        text++;
+      }
+      bool eoi = false;
+      if (text < run) {
+        run = text;  // bit image follows
+      } else if (run < InBuffered()) {
+        uint8_t next = InPeek(run);
+        eoi = isJobMarker(next);
+      } else if (last && run == InAvailable()) {
+        eoi = true;
+      } else {
+        run--;  // hold back, may need EOI
+      }
+      used = 0;
+      ok = DrainStage();
+      if (ok) {
+        used = iec.SendAsync(data, run, eoi);
+        ok = iec.isOk();
+      }
+    }
+    if (used == 0) {
+      break;  // bus busy or byte held back
+    }
+    InConsume(used);
+    escapeHeld = false;
   }
-  return ok;
+
+  // Report if error and abort session
+  if (!ok && !RecoverBus()) {
+    usb.println(F("IEC listen error"));
+    EndSession();
+  }
+}
+
+/// Check if a received byte is a job marker. PETSCII data is passed byte
+/// exact: markers are only taken in ASCII, raster and escaped jobs, else a
+/// job header is only read at the session start.
+/// In ASCII mode markers are control characters, never printed, and raster
+/// image data is counted, not checked for markers.
+/// @param c is the received byte, not following a JOB_ESCAPE
+/// @return true if it is JOB_START or JOB_END in a job that takes them
+bool isJobMarker(uint8_t c) {
+  return ((c == JOB_END || c == JOB_START) && (asciiMode || rasterMode || escapedMode));
+}
+
+/// Translate a run of received bytes into the staging buffer, ASCII text
+/// going through the line formatter
+/// @param data[] is the run of received bytes
+/// @param length is the run length
+/// @param last if true no more data is coming, the last word ends with it
+/// @return number of bytes translated, limited by the staging buffer room
+size_t TranslateRun(const uint8_t data[], size_t length, bool last) {
+  size_t i = 0;
+  while (i < length) {
+    if (STAGE_SIZE - stageTail < STAGE_MAX_EXPANSION) {
+      break;  // staging buffer full
+    }
+    if (!asciiMode || LINE_WIDTH == 0) {
+      Translate(data[i++]);
+    } else if (blanksOut > 0) {
+      blanksOut--;
+      Translate(' ');
+    } else if (wordLeft == 0 && isWordChar(data[i], utf8Length > 0)) {
+      if (!PlaceWord(i, last)) {
+        break;  // word end not received yet
+      }
+    } else {
+      Format(data[i++]);
+    }
+  }
+  return i;
+}
+
+/// Formatter stage: word-wrap at LINE_WIDTH, tab expansion and CR, LF or
+/// CR LF line ends to CR, for ASCII text going to Translate().
+/// Words are placed whole by looking ahead in the input queue, so no line
+/// is buffered. Blanks are held until the next word and dropped at line ends.
+/// @param c is the received byte, not the first character of a word
+void Format(uint8_t c) {
+  if (c == CR || c == LF) {
+    if (c == LF && lineEndCR) {
+      lineEndCR = false;
+      return;  // CR LF
+    }
+    NewLine();
+    lineEndCR = (c == CR);
+    return;
+  }
+  lineEndCR = false;
+  if (c == ' ' || c == TAB) {
+    if (heldBlanks < LINE_WIDTH) {
+      heldBlanks += (c == TAB) ? TAB_WIDTH - (lineColumn + heldBlanks) % TAB_WIDTH : 1;
+    }
+    wordLeft = 0;
+    return;
+  }
+  if (isWordChar(c, utf8Length > 0)) {
+    wordLeft--;
+    lineColumn++;
+  }
+  Translate(c);  // control characters are dropped there
+}
+
+/// Place the word starting at a received byte on the current line if it
+/// fits, else on a new line. Its held blanks are sent first, if it fits.
+/// @param offset is the word position in the input queue
+/// @param last if true no more data is coming
+/// @return false if the word end is not received yet
+bool PlaceWord(size_t offset, bool last) {
+  uint8_t length = WordLength(offset, last);
+  if (length == 0) {
+    return false;
+  }
+  if (lineColumn + heldBlanks + length > LINE_WIDTH) {
+    // Word does not fit, blanks dropped
+    if (lineColumn > 0) {
+      NewLine();
+    }
+    heldBlanks = 0;
+  }
+  blanksOut = heldBlanks;
+  lineColumn += heldBlanks;
+  heldBlanks = 0;
+  wordLeft = length;
+  return true;
+}
+
+/// Printed length of the word starting at a received byte.
+/// Words longer than a line are broken at LINE_WIDTH characters.
+/// @param offset is the word position in the input queue
+/// @param last if true no more data is coming
+/// @return word length in characters, 0 if its end is not received yet
+uint8_t WordLength(size_t offset, bool last) {
+  size_t buffered = InBuffered();
+  uint8_t length = 0;
+  uint8_t sequence = 0;  // UTF-8 continuation bytes expected
+  for (size_t i = offset; i < buffered; i++) {
+    uint8_t c = InPeek(i);
+    if (c == ' ' || c == TAB || c == CR || c == LF || c == JOB_END || c == JOB_START) {
+      return length;
+    }
+    if (!isWordChar(c, sequence > 0)) {
+      sequence = (sequence > 0 && (c & 0xC0) == 0x80) ? sequence - 1 : 0;
+      continue;
+    }
+    uint8_t lead = Utf8Length(c);
+    sequence = (lead > 0) ? lead - 1 : 0;
+    if (++length == LINE_WIDTH) {
+      return length;
+    }
+  }
+  // Word goes on past the buffered bytes: ended by the input end or by a full queue
+  size_t window = spooling ? spoolCache.Capacity() : usb.Capacity();
+  return ((last && buffered == InAvailable()) || buffered >= window) ? length : 0;
+}
+
+/// @param c is a received ASCII byte
+/// @param sequence is true inside a UTF-8 character, where the lead byte is its column
+/// @return true if it is printed, not a blank, line end, control character nor UTF-8 continuation
+bool isWordChar(uint8_t c, bool sequence) {
+  if (sequence && (c & 0xC0) == 0x80) {
+    return false;
+  }
+  return (c > ' ' && pgm_read_byte(&AsciiTable[c]) != DROP);
+}
+
+/// @param c is a received byte
+/// @return UTF-8 character length in bytes if c is a lead byte, else 0
+uint8_t Utf8Length(uint8_t c) {
+  if (!UTF8_TEXT || c < 0xC2 || c > 0xF4) {
+    return 0;
+  }
+  return (c < 0xE0) ? 2 : (c < 0xF0) ? 3 : 4;
+}
+
+/// End the printer line, dropping held blanks
+void NewLine() {
+  Translate(CR);
+  lineColumn = 0;
+  heldBlanks = 0;
+  wordLeft = 0;
+}
+
+/// Restart the formatter at the start of a printer line
+void FormatReset() {
+  lineColumn = 0;
+  heldBlanks = 0;
+  blanksOut = 0;
+  wordLeft = 0;
+  lineEndCR = false;
+}
+
+/// Output stage: queue staged bytes for background transmission.
+/// The last staged byte is held back until more bytes are staged or the
+/// session closes, so EOI goes with the true last byte of the job.
+/// @param last if true waits until all staged bytes are queued, last one with EOI
+/// @return true if OK, false if error
+bool OutputStage(bool last) {
+  if (last) {
+    EncodeFlush();
+  }
+  uint8_t keep = last ? 0 : 1;
+  while (stageTail - stageHead > keep) {
+    wdt_reset();
+    uint8_t length = stageTail - stageHead - keep;
+    stageHead += iec.SendAsync(&stage[stageHead], length, last);
+    if (!iec.isOk()) {
+      return false;  // transmission error
+    }
+    if (!last) {
+      break;  // bus busy, back to translation
+    }
+  }
+  // Move remaining bytes to staging buffer start
+  memmove(stage, &stage[stageHead], stageTail - stageHead);
+  stageTail -= stageHead;
+  stageHead = 0;
+  return true;
+}
+
+/// Parse a PBM raw bitmap header ("P4", width, height) from a run of received
+/// bytes. Bytes outside a header are dropped.
+/// @param data[] is the run of received bytes
+/// @param length is the run length
+/// @return number of bytes used, up to the header end
+size_t RasterHeader(const uint8_t data[], size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    uint8_t c = data[i];
+    if (rasterState == RASTER_MAGIC) {
+      if (c == 'P') {
+        rasterState = RASTER_FORMAT;
+      }
+    } else if (rasterState == RASTER_FORMAT) {
+      rasterState = (c == '4') ? RASTER_WIDTH : RASTER_MAGIC;
+    } else if (rasterComment) {
+      rasterComment = (c != '\n');
+    } else if (c == '#') {
+      rasterComment = true;
+    } else if (c >= '0' && c <= '9') {
+      if (rasterNumber < 10000) {
+        rasterNumber = rasterNumber * 10 + (c - '0');
+      }
+      rasterDigits = true;
+    } else if (!isspace(c)) {
+      RasterReset();  // not a PBM header
+    } else if (rasterDigits) {
+      // Number ends at a white space
+      if (rasterState == RASTER_WIDTH) {
+        rasterWidth = rasterNumber;
+        rasterState = RASTER_HEIGHT;
+      } else {
+        RasterStart(rasterNumber);
+        return i + 1;
+      }
+      rasterNumber = 0;
+      rasterDigits = false;
+    }
+  }
+  return length;
+}
+
+/// Start printing a raster image after its header
+/// @param height is the image height in dots
+void RasterStart(uint16_t height) {
+  rasterRowBytes = (rasterWidth + 7) / 8;
+  rasterLeft = (uint32_t)rasterRowBytes * height;
+  rasterColumn = 0;
+  // A band is transposed in place and must fit the input queue
+  size_t capacity = spooling ? spoolCache.Capacity() : usb.Capacity();
+  rasterDiscard = ((size_t)RASTER_ROWS * rasterRowBytes > capacity);
+  if (rasterDiscard) {
+    usb.println(F("Raster image too wide, skipped"));
+  }
+  RasterReset();
+}
+
+/// Restart the raster header parser
+void RasterReset() {
+  rasterState = RASTER_MAGIC;
+  rasterComment = false;
+  rasterDigits = false;
+  rasterNumber = 0;
+}
+
+/// Raster stage: transpose the band of raster rows at the input start into
+/// bit image columns in the staging buffer, 8 columns at a time while there
+/// is room. A band is up to RASTER_ROWS rows, one printed line, and is
+/// removed from input once staged.
+/// @param last if true no more data is coming, a truncated image is dropped
+/// @return true if data was staged or removed, false if waiting
+bool RasterBand(bool last) {
+  if (rasterDiscard || skipping) {
+    size_t n = min((uint32_t)InBuffered(), rasterLeft);
+    InConsume(n);
+    rasterLeft -= n;
+    return (n > 0);
+  }
+  uint8_t rows = min(rasterLeft / rasterRowBytes, (uint32_t)RASTER_ROWS);
+  size_t band = (size_t)rows * rasterRowBytes;
+  if (InBuffered() < band) {
+    if (last && InAvailable() < band) {
+      // Truncated image
+      rasterLeft = InAvailable();
+      rasterDiscard = true;
+      return true;
+    }
+    return false;
+  }
+  bool staged = false;
+  while (STAGE_SIZE - stageTail >= STAGE_MAX_EXPANSION) {
+    if (rasterColumn == rasterRowBytes) {
+      // Band done, print the line
+      Encode(CMD_IMAGE_END);
+      Encode(CR);
+      InConsume(band);
+      rasterLeft -= band;
+      rasterColumn = 0;
+      return true;
+    }
+    if (rasterColumn == 0) {
+      Encode(CMD_IMAGE_BEGIN);
+    }
+    RasterColumns(rasterColumn, rows);
+    rasterColumn++;
+    staged = true;
+  }
+  return staged;
+}
+
+/// Transpose 8 raster columns of the band into bit image column bytes.
+/// Raster rows are packed MSB first, bit=1 is a dot. Column bit 0 is the top dot.
+/// @param offset is the byte position in the band rows
+/// @param rows is the number of band rows
+void RasterColumns(uint16_t offset, uint8_t rows) {
+  uint8_t columns[8] = { 0 };
+  uint8_t dot = 1;
+  for (uint8_t row = 0; row < rows; row++) {
+    uint8_t bits = InPeek(offset + (size_t)row * rasterRowBytes);
+    for (uint8_t i = 0; bits != 0; i++) {
+      if (bits & 0x80) {
+        columns[i] |= dot;
+      }
+      bits <<= 1;
+    }
+    dot <<= 1;
+  }
+  uint16_t count = rasterWidth - offset * 8;
+  if (count > 8) {
+    count = 8;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    Encode(IMAGE_COLUMN | columns[i]);
+  }
+}
+
+/// Queue all staged bytes for background transmission, more job data follows
+/// @return true if OK, false if error
+bool DrainStage() {
+  while (stageTail > stageHead) {
+    wdt_reset();
+    stageHead += iec.SendAsync(&stage[stageHead], stageTail - stageHead, false);
+    if (!iec.isOk()) {
+      return false;  // transmission error
+    }
+  }
+  stageHead = stageTail = 0;
+  return true;
+}
+
+/// Translation stage: append a received byte to the staging buffer
+/// translating it to PETSCII in ASCII mode. UTF-8 characters are decoded
+/// across calls; bytes of a broken sequence print as 8 bit codes.
+/// @param c is the received byte
+void Translate(uint8_t c) {
+  if (!asciiMode) {
+    // Unchanged PETSCII
+    Encode(c);
+    return;
+  }
+  // Set printer to Business mode once per session
+  if (!businessMode) {
+    Encode(CMD_BUSINESS);
+    businessMode = true;
+  }
+  if (utf8Length > 0) {
+    if ((c & 0xC0) == 0x80) {
+      // UTF-8 continuation byte
+      utf8Held[utf8Count++] = c;
+      if (utf8Count == utf8Length) {
+        TranslateUtf8();
+      }
+      return;
+    }
+    // Not UTF-8, held bytes are 8 bit codes
+    for (uint8_t i = 0; i < utf8Count; i++) {
+      TranslateAscii(utf8Held[i]);
+    }
+  }
+  utf8Length = Utf8Length(c);
+  if (utf8Length > 0) {
+    // UTF-8 lead byte
+    utf8Held[0] = c;
+    utf8Count = 1;
+    return;
+  }
+  TranslateAscii(c);
+}
+
+/// Translate an ASCII or 8 bit code to PETSCII or a custom glyph
+/// @param c is the received byte
+void TranslateAscii(uint8_t c) {
+  for (uint8_t slot = 0; slot < GLYPH_CACHE && c != GLYPH_FREE; slot++) {
+    if (glyphCodes[slot] == c) {
+      CustomGlyph(slot);
+      return;
+    }
+  }
+  uint8_t code = pgm_read_byte(&AsciiTable[c]);
+  if (code == DROP) {
+    droppedBytes++;
+    return;  // avoiding control characters
+  }
+  if (code > GLYPH_ASCII) {
+    Encode(code);
+    return;
+  }
+  Glyph(code);
+}
+
+/// Translate the decoded UTF-8 character to PETSCII, looking it up in Utf8Table
+void TranslateUtf8() {
+  uint32_t codepoint = utf8Held[0] & (0x7F >> utf8Length);
+  for (uint8_t i = 1; i < utf8Length; i++) {
+    codepoint = (codepoint << 6) | (utf8Held[i] & 0x3F);
+  }
+  utf8Length = 0;
+  // Binary search
+  uint8_t low = 0;
+  uint8_t high = UTF8_COUNT;
+  while (low < high) {
+    uint8_t mid = (low + high) / 2;
+    uint16_t key = pgm_read_word(&Utf8Table[mid].codepoint);
+    if (key == codepoint) {
+      uint8_t code = pgm_read_byte(&Utf8Table[mid].code);
+      if (code >= ' ') {
+        Encode(code);
+      } else {
+        Glyph(code);
+      }
+      return;
+    }
+    if (key < codepoint) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  droppedBytes++;  // not printable
+}
+
+/// Append a bit image glyph to the staging buffer. Glyphs following each
+/// other are joined into one bit image by the encoder
+/// @param n is the glyph number, 1 to GLYPH_COUNT
+void Glyph(uint8_t n) {
+  Encode(CMD_IMAGE_BEGIN);
+  for (uint8_t i = 0; i < GLYPH_COLUMNS; i++) {
+    Encode(pgm_read_byte(&GlyphImg[n - 1][i]));
+  }
+  Encode(CMD_IMAGE_END);
+}
+
+/// Append a custom glyph to the staging buffer
+/// @param slot is the custom glyph, 0 to GLYPH_CACHE-1
+void CustomGlyph(uint8_t slot) {
+  int address = GlyphAddress(slot) + 1;
+  Encode(CMD_IMAGE_BEGIN);
+  for (uint8_t i = 0; i < GLYPH_COLUMNS; i++) {
+    Encode(EEPROM.read(address + i));
+  }
+  Encode(CMD_IMAGE_END);
+}
+
+/// Encoding stage: append a printer byte to the staging buffer.
+/// Runs of identical bit image columns are sent as repeat commands, and
+/// a bit image end followed by a new bit image is dropped, so repeated
+/// glyphs become a single bit image with their column runs joined.
+/// Other bytes below IMAGE_COLUMN end the bit image.
+/// @param c is the printer byte
+void Encode(uint8_t c) {
+  if (REPEAT_MIN == 0) {
+    stage[stageTail++] = c;  // encoder disabled
+    return;
+  }
+  if (imageArgs > 0) {
+    // Repeat command from the host
+    imageArgs--;
+    stage[stageTail++] = c;
+    return;
+  }
+  if (imageEndHeld) {
+    imageEndHeld = false;
+    if (c == CMD_IMAGE_BEGIN) {
+      return;  // bit image goes on
+    }
+    EndImage();
+  }
+  if (!imageMode) {
+    stage[stageTail++] = c;
+    imageMode = (c == CMD_IMAGE_BEGIN);
+    return;
+  }
+  if (c >= IMAGE_COLUMN) {
+    // Bit image column, extend or start a run
+    if (repeatCount > 0 && (c != repeatColumn || repeatCount == REPEAT_MAX)) {
+      EndRepeat();
+    }
+    repeatColumn = c;
+    repeatCount++;
+    return;
+  }
+  if (c == CMD_IMAGE_END) {
+    imageEndHeld = true;
+    return;
+  }
+  EndRepeat();
+  stage[stageTail++] = c;
+  if (c == CMD_IMAGE_REPEAT) {
+    imageArgs = 2;  // count and column
+  } else {
+    imageMode = false;
+  }
+}
+
+/// Stage the pending bit image column run, as a repeat command if long enough
+void EndRepeat() {
+  if (repeatCount >= REPEAT_MIN) {
+    stage[stageTail++] = CMD_IMAGE_REPEAT;
+    stage[stageTail++] = repeatCount;
+    stage[stageTail++] = repeatColumn;
+  } else {
+    memset(&stage[stageTail], repeatColumn, repeatCount);
+    stageTail += repeatCount;
+  }
+  repeatCount = 0;
+}
+
+/// Stage the pending column run and the bit image end
+void EndImage() {
+  EndRepeat();
+  stage[stageTail++] = CMD_IMAGE_END;
+  imageMode = false;
+}
+
+/// Stage all bytes held by the encoder, at the end of print data
+void EncodeFlush() {
+  EndRepeat();
+  if (imageEndHeld) {
+    imageEndHeld = false;
+    EndImage();
+  }
+}
+
+/// Restart the encoder for a new printer, which is not in bit image mode
+void EncodeReset() {
+  imageMode = false;
+  imageEndHeld = false;
+  imageArgs = 0;
+  repeatCount = 0;
 }
 
 //-----------------------------------------------
@@ -255,23 +1927,59 @@ bool SendAscii() {
 //-----------------------------------------------
 
 void setup() {
+#ifdef BOARD_AVR
+  // Keep reset cause, stop a watchdog left running by the reset
+  resetCause = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+#endif
+#if EEPROM_EMULATED
+  EEPROM.begin(EEPROM_EMULATED);
+#endif
+  LoadGlyphs();
+  LoadSettings();
+
   // Configure on-board LED for busy indication
-  pinMode(LED_BUILTIN, OUTPUT);
-  digitalWrite(LED_BUILTIN, LOW);
+  pinMode(LED_BUSY, OUTPUT);
+  digitalWrite(LED_BUSY, LOW);
 
   // Configure setting pins
   pinMode(SW_PAD,   INPUT_PULLUP);
   pinMode(SW_SAD,   INPUT_PULLUP);
   pinMode(SW_ASCII, INPUT_PULLUP);
+  pinMode(SW_XON,   INPUT_PULLUP);
+  pinMode(SW_RTS,   INPUT_PULLUP);
+  pinMode(SW_SPOOL, INPUT_PULLUP);
+  pinMode(SW_MIRROR, INPUT_PULLUP);
+
+  // start serial communication (8N1) at the stored speed, else detect host speed
+  if (settings.baudrate) {
+    usb.Begin(settings.baudrate);
+  } else {
+    usb.Begin(BAUDRATE);
+    if (AUTOBAUD) {
+      usb.AutoBaud(AUTOBAUD);
+    }
+  }
 
-  // start serial communication
-  Serial.begin(BAUDRATE, SERIAL_8N1);
-  Serial.setTimeout(TIMEOUT);  // serial timeout in ms (default is 1000ms)
-  while(!Serial);
+  // Find spool storage
+  if (spool) {
+    spoolReady = spool->Begin();
+  }
+
+  // Enable IEC fast serial protocols
+  iec.SetFastModes(FAST_SERIAL);
 
   ReadSettings();
 
-  Greatings();
+  // Ready to print at once with stored settings, the host asks for the settings report
+  if (!hostSettings) {
+    Greatings();
+  }
+
+#ifdef WATCHDOG
+  wdt_enable(WATCHDOG);
+#endif
 }
 
 //-----------------------------------------------
@@ -279,18 +1987,78 @@ void setup() {
 //-----------------------------------------------
 
 void loop() {
-  // Read data from serial interface to buffer
-  bytesReceived = Serial.readBytes(buffer, BUFFER_SIZE);
+  wdt_reset();
+
+  // Sleep until a received byte, a bus handshake or the millis() tick.
+  // Not at all when a byte came since the last pass woke up.
+  // Spool transfers are polled
+  if (LOW_POWER && !spooling) {
+    IecHal::Sleep([]() { return usb.Queued() == rxSeen; });
+  }
+  rxSeen = usb.Available();
+
+  // Session time, and time waiting the host with nothing to send
+  unsigned long now = millis();
+  if (session) {
+    sessionTime += now - loopTime;
+    if (InAvailable() == 0 && !iec.TxBusy()) {
+      inputWait += now - loopTime;
+    }
+  }
+  loopTime = now;
+
+  // Acknowledge host tool frames
+  usb.Service();
+
+  // Move received data to spool storage
+  if (spooling) {
+    RunSpool();
+  }
 
-  // Send buffered data to printer
-  if (bytesReceived > 0) {
+  // Host changing speed: RX is off until auto-baud runs, so the session
+  // ends now instead of after the session timeout
+  if (AUTOBAUD && usb.isBreak() && session) {
+    CloseSession();
+  }
+
+  if (!session) {
+    // Host changing speed
+    if (AUTOBAUD && usb.isBreak() && !iec.TxBusy()) {
+      usb.AutoBaud(AUTOBAUD);
+      Greatings();
+      return;
+    }
+    // Interface command
+    if (isCommand()) {
+      RunCommand();
+      return;
+    }
+    // Wait for a half full queue or an input pause before printing
+    uint32_t queued = InAvailable();
+    if (queued == 0) {
+      ReadSettings();  // follow switch changes while idle
+      PollDevices();
+      return;
+    }
+    if (!isStartDue(queued)) {
+      return;
+    }
     // On-board LED On --> Busy. Printing in progress
-    digitalWrite(LED_BUILTIN, HIGH);
-    // Read user settings before printing
-    ReadSettings();
-    // Send data to printer
-    PrintBuffer();
+    digitalWrite(LED_BUSY, HIGH);
+    OpenSession();
+  }
+
+  // Send queued data to printer, up to the last byte after an input pause
+  bool idle = (usb.Idle() >= settings.sessionTimeout);
+  PrintBuffer(idle);
+
+  // End print job after an input pause
+  if (session && idle && InAvailable() == 0) {
+    CloseSession();
+  }
+
+  if (!session) {
     // On-board LED Off --> Not printing
-    digitalWrite(LED_BUILTIN, LOW);
+    digitalWrite(LED_BUSY, LOW);
   }
 }
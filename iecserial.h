@@ -1,132 +1,391 @@
-/**************************************************************
- * iecserial.h
- * IecSerial class declaration
- * A class for USB to Commodore IEC Serial Bus interface
- *
- * AUTHOR:
- * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
- *
- * REFERENCES:
- * "IEC disected" 2008 by J. Derogee
- * "VIC Revealed" 1982 by Nick Hampshire
- * "COMPUTE!", How The VIC/64 Serial Bus Works, July 1983 by Jim Butterfield
- *
- * LICENSE:
- * This file is part of IECprinter.
- *
- * IECprinter is free software: you can redistribute it and/or modify it under
- * the terms of the GNU General Public License as published by the Free
- * Software Foundation, either version 3 of the License, or (at your option)
- * any later version.
- *
- * IECprinter is distributed in the hope that it will be useful, but WITHOUT
- * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
- * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
- * more details.
- *
- * You should have received a copy of the GNU General Public License along
- * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
- **************************************************************/
-
-#pragma once
-
-#include <Arduino.h>
-#include <stdint.h>
-
-/// USB to Commodore IEC Serial Bus Interface
-class IecSerial {
-public:
-  IecSerial(uint8_t srqPin,uint8_t atnPin,uint8_t clkPin,uint8_t dioPin,uint8_t rstPin);
-  ~IecSerial();
-
-  bool Command(uint8_t cmd);
-  bool Command(uint8_t cmd[], size_t length);
-
-  bool Talk(uint8_t pad);
-  bool Talk(uint8_t pad, uint8_t sad);
-
-  bool Listen(uint8_t pad);
-  bool Listen(uint8_t pad, uint8_t sad);
-
-  bool Untalk();
-  bool Unlisten();
-
-  void Reset();
-
-  bool Send(uint8_t data, bool eoi = false);
-  bool Send(const uint8_t data[], size_t length, bool eoi = false);
-  bool Send(const char* str, bool eoi = false);
-  bool Get(uint8_t data[], size_t maxlength);
-  bool Get(char* str, size_t maxlength);
-
-  uint8_t Status() { return m_status; };
-  bool isOk() { return (m_status == STATUS_OK); };
-
-public:
-  static const char* Version;
-  // Commands
-  static constexpr uint8_t CMD_LISTEN    = 0x20;
-  static constexpr uint8_t CMD_TALK      = 0x40;
-  static constexpr uint8_t CMD_UNTALK    = 0x5F;
-  static constexpr uint8_t CMD_UNLISTEN  = 0x3F;
-  static constexpr uint8_t CMD_SECONDARY = 0x60;
-  // Status
-  static constexpr uint8_t STATUS_OK             = 0;
-  static constexpr uint8_t STATUS_TIMEOUT        = 0b00000001;
-  static constexpr uint8_t STATUS_FRAMMING_ERROR = 0b00000100;
-  static constexpr uint8_t STATUS_NO_DEVICE      = 0b10000000;
-
-private:
-  inline void Assert(uint8_t pins) __attribute__((always_inline));
-  inline void Release(uint8_t pins) __attribute__((always_inline));
-  void ReleaseAll();
-
-  inline bool isAsserted(uint8_t pins) __attribute__((always_inline));
-  inline bool isReleased(uint8_t pins) __attribute__((always_inline));
-  bool WaitAssertionOrTimeout(uint8_t pins, unsigned long timeout);
-  void WaitAssertion(uint8_t pins);
-  bool WaitReleaseOrTimeout(uint8_t pins, unsigned long timeout);
-  void WaitRelease(uint8_t pins);
-
-  bool Turnaround();
-  void SendBits(uint8_t data);
-  void GetBits(uint8_t& data);
-
-private:
-  /// IEC serial bus timings (microseconds)
-  // Tat: ATN response. If exceeded, device not present.
-  static constexpr unsigned long TIME_TAT = 1000;  // TAT: max 1000 us
-  // Tne: Non-EOI response to RFD. If exceeded, EOI response required.
-  static constexpr unsigned long TIME_TNE = 40;  // TNE: max 200us (40us typ)
-  // Ts: Bit Set-up Talker. Tv and Tr min must be 60us for external device to be a talker.
-  static constexpr unsigned long TIME_TS = 70;  // TS: min 20us (70us typ)
-  // Tv: Data Valid.
-  static constexpr unsigned long TIME_TV = 20;  // TV: min 20us (20us typ)
-  // Tf: Frame Handshake. If exceeded, frame error.
-  static constexpr unsigned long TIME_TF = 1000;  // TF: 0 to 1000us (20us typ)
-  // Tr: Frame to Release of ATN.
-  static constexpr unsigned long TIME_TR = 20;  // TR: min 20us (20us typ)
-  // Tbb: Between Bytes Time.
-  static constexpr unsigned long TIME_TBB = 100;  // YBB: min 100us (100us typ)
-  // Tye: EOI response time.
-  static constexpr unsigned long TIME_TYE = 250;  // TYE: min 200us (250us typ)
-  // EOI Response Hold Time. min must be 80us for external device to be a listener
-  static constexpr unsigned long TIME_TEI = 500;  // TEI: min 60us / 80us
-  // Try: Talker Response Limit.
-  static constexpr unsigned long TIME_TRY = 30;  // TRY: 0 to 60us (30us typ)
-  // Ttk: Talk-Attention Release.
-  static constexpr unsigned long TIME_TTK = 30;  // TTK: 20us to 100us (30us typ)
-  // Tdc: Talk-Attention Acknowledge.
-  static constexpr unsigned long TIME_TDC = 30;  // TDC: min 0
-  // Tda: Talk-Attention Acknowledge Hold.
-  static constexpr unsigned long TIME_TDA = 100;  // TDA: min 80us
-
-  /// IEC interface pin bit masks at PORT D
-  uint8_t srqBit;  // Service Request bit
-  uint8_t rstBit;  // Reset bit
-  uint8_t clkBit;  // Clock bit
-  uint8_t dioBit;  // Data I/O bit
-  uint8_t atnBit;  // Attention bit
-
-  uint8_t m_status;
-};
+/**************************************************************
+ * iecserial.h
+ * IecSerial class declaration
+ * A class for USB to Commodore IEC Serial Bus interface
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * REFERENCES:
+ * "IEC disected" 2008 by J. Derogee
+ * "VIC Revealed" 1982 by Nick Hampshire
+ * "COMPUTE!", How The VIC/64 Serial Bus Works, July 1983 by Jim Butterfield
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "ringbuffer.h"
+#include "iechal.h"
+
+/**************************************************************
+ * The bus protocol is written once in IecSerialBase<Port>, where Port
+ * is a pin mask policy for the IEC lines on the IecHal backend port,
+ * AVR Port D or a GPIO window (see iechal.h):
+ *   IecPortD<SRQ,ATN,CLK,DIO,RST> : masks are compile time constants,
+ *     so line toggles compile to single sbi/cbi instructions.
+ *   IecPortDPins : masks set at run time by the constructor.
+ *
+ *   IecSerialT<SRQ,ATN,CLK,DIO,RST> : fast, pins fixed at compile time
+ *   IecSerial(srq,atn,clk,dio,rst) : run time pins, for compatibility
+ **************************************************************/
+
+/// Talker bit timing profile (microseconds)
+struct IecTiming {
+  uint8_t tne;  // Non-EOI response to RFD
+  uint8_t ts;   // Bit set-up talker
+  uint8_t tv;   // Data valid
+  uint8_t tbb;  // Between bytes
+};
+
+/// Bus instrumentation: log2 histograms of handshake times and counters.
+/// Histogram bucket i counts times from 2^i to 2^(i+1)-1 microseconds,
+/// bucket 0 times below 2us and the last bucket all longer times.
+struct IecStats {
+  static constexpr uint8_t BUCKETS = 16;
+  uint16_t ready[BUCKETS];    // Listener Ready for Data wait
+  uint16_t accept[BUCKETS];   // Listener Data Accepted wait
+  uint16_t eoi[BUCKETS];      // EOI handshake
+  uint16_t command[BUCKETS];  // ATN command sequence (LISTEN, TALK...)
+  uint32_t bytes;             // Data bytes accepted by listeners
+  uint16_t framingErrors;     // Data bytes not accepted
+};
+
+/// IEC Serial Bus definitions shared by all IecSerial variants
+class IecBus {
+public:
+  static const char* Version;
+  // Commands
+  static constexpr uint8_t CMD_LISTEN    = 0x20;
+  static constexpr uint8_t CMD_TALK      = 0x40;
+  static constexpr uint8_t CMD_UNTALK    = 0x5F;
+  static constexpr uint8_t CMD_UNLISTEN  = 0x3F;
+  static constexpr uint8_t CMD_SECONDARY = 0x60;
+  // Status
+  static constexpr uint8_t STATUS_OK             = 0;
+  static constexpr uint8_t STATUS_TIMEOUT        = 0b00000001;
+  static constexpr uint8_t STATUS_NOT_READY      = 0b00000010;  // Listener held Ready for Data off
+  static constexpr uint8_t STATUS_FRAMMING_ERROR = 0b00000100;
+  static constexpr uint8_t STATUS_TALKER_TIMEOUT = 0b00001000;  // Talker stopped clocking bits
+  static constexpr uint8_t STATUS_NO_LISTENER    = 0b01000000;  // Addressed device not present
+  static constexpr uint8_t STATUS_NO_DEVICE      = 0b10000000;
+  // Fast serial protocols
+  static constexpr uint8_t FAST_NONE  = 0;
+  static constexpr uint8_t FAST_JIFFY = 0b00000001;  // JiffyDOS
+  static constexpr uint8_t FAST_BURST = 0b00000010;  // CBM fast serial (C128 burst)
+  // Max devices addressed by a single multi-listener LISTEN
+  static constexpr uint8_t MAX_LISTENERS = 4;
+
+protected:
+  /// IEC serial bus timings (microseconds)
+  // Tat: ATN response. If exceeded, device not present.
+  static constexpr unsigned long TIME_TAT = 1000;  // TAT: max 1000 us
+  // Tne: Non-EOI response to RFD. If exceeded, EOI response required.
+  static constexpr unsigned long TIME_TNE = 40;  // TNE: max 200us (40us typ)
+  // Ts: Bit Set-up Talker. Tv and Tr min must be 60us for external device to be a talker.
+  static constexpr unsigned long TIME_TS = 70;  // TS: min 20us (70us typ)
+  // Tv: Data Valid.
+  static constexpr unsigned long TIME_TV = 20;  // TV: min 20us (20us typ)
+  // Tf: Frame Handshake. If exceeded, frame error.
+  static constexpr unsigned long TIME_TF = 1000;  // TF: 0 to 1000us (20us typ)
+  // Tr: Frame to Release of ATN.
+  static constexpr unsigned long TIME_TR = 20;  // TR: min 20us (20us typ)
+  // Tbb: Between Bytes Time.
+  static constexpr unsigned long TIME_TBB = 100;  // YBB: min 100us (100us typ)
+  // Tye: EOI response time.
+  static constexpr unsigned long TIME_TYE = 250;  // TYE: min 200us (250us typ)
+  // EOI Response Hold Time. min must be 80us for external device to be a listener
+  static constexpr unsigned long TIME_TEI = 500;  // TEI: min 60us / 80us
+  // Try: Talker Response Limit.
+  static constexpr unsigned long TIME_TRY = 30;  // TRY: 0 to 60us (30us typ)
+  // Ttk: Talk-Attention Release.
+  static constexpr unsigned long TIME_TTK = 30;  // TTK: 20us to 100us (30us typ)
+  // Tdc: Talk-Attention Acknowledge.
+  static constexpr unsigned long TIME_TDC = 30;  // TDC: min 0
+  // Tda: Talk-Attention Acknowledge Hold.
+  static constexpr unsigned long TIME_TDA = 100;  // TDA: min 80us
+  // Th: Listener Hold-off. Unlimited by spec, bounded to catch a jammed or off printer.
+  static constexpr unsigned long TIME_TH = 5000000;  // TH: 0 to infinite (longest line print)
+  // Talker bit time limit while receiving.
+  static constexpr unsigned long TIME_TALKER_BIT = 1000;
+  // Talker Ready to Send limit while receiving, device preparing its data.
+  static constexpr unsigned long TIME_TALKER_READY = 100000;
+  // Listener EOI detect: talker silent after Ready for Data signals EOI.
+  static constexpr unsigned long TIME_EOI_DETECT = 200;  // TNE: max 200us
+  // Listener EOI acknowledge hold.
+  static constexpr unsigned long TIME_TEI_HOLD = 80;  // TEI: min 60us / 80us
+  // Device start up after a bus reset (milliseconds)
+  static constexpr unsigned long TIME_RESET_BOOT = 2000;
+
+  /// JiffyDOS timings (microseconds)
+  // ATN command bit 7 hold, device asserts DIO during it if JiffyDOS capable
+  static constexpr unsigned int TIME_JIFFY_DETECT = 400;
+  // Bit pair output times, listener samples about 4us after each
+  static constexpr uint8_t TIME_JIFFY_START = 11;  // CLK release (start) to bits 4,5
+  static constexpr uint8_t TIME_JIFFY_PAIR1 = 10;  // bits 4,5 to bits 6,7
+  static constexpr uint8_t TIME_JIFFY_PAIR2 = 11;  // bits 6,7 to bits 3,1
+  static constexpr uint8_t TIME_JIFFY_PAIR3 = 13;  // bits 3,1 to bits 2,0
+  static constexpr uint8_t TIME_JIFFY_PAIR4 = 13;  // bits 2,0 to EOI flag
+  static constexpr uint8_t TIME_JIFFY_EOI   = 6;   // EOI flag hold
+
+  /// CBM fast serial timings (microseconds)
+  static constexpr uint8_t TIME_BURST_HALF = 4;     // SRQ clock half period
+  static constexpr unsigned int TIME_BURST_ACK = 100;  // Data Accepted limit, below listener EOI timeout (200us)
+
+  /// Spec minimum values for tuned talker timings (microseconds)
+  static constexpr uint8_t TIME_TNE_MIN = 20;   // Keep margin to listener RFD polling
+  static constexpr uint8_t TIME_TS_MIN  = 20;   // TS: min 20us
+  // Tv and Tbb are not tuned: TIME_TV and TIME_TBB are already their spec minimums
+
+  /// Bit output kernel of SendBits() (CPU cycles)
+  static constexpr unsigned int CYCLES_PER_US = F_CPU / 1000000UL;
+  static constexpr uint8_t CYCLES_PER_LOOP = 4;     // IecHal::DelayLoop() pass
+  // Line accesses between bit edges, taken off the delays. Lower bounds,
+  // so a bit phase never gets shorter than its timing.
+  static constexpr uint8_t CYCLES_BIT_PREPARE = 6;  // CLK assert to DIO change
+  static constexpr uint8_t CYCLES_BIT_SETUP   = 2;  // DIO change to CLK release
+  static constexpr uint8_t CYCLES_BIT_VALID   = 6;  // CLK release to next CLK assert
+
+  /// Delay loops for a bit phase
+  /// @param us is the phase time [us]
+  /// @param cycles are the cycles of the line accesses within the phase
+  /// @return IecHal::DelayLoop() loops, rounded up, at least 1
+  static constexpr uint16_t DelayLoops(unsigned int us, uint8_t cycles) {
+    return (us * CYCLES_PER_US > (unsigned int)cycles + CYCLES_PER_LOOP)
+           ? (us * CYCLES_PER_US - cycles + CYCLES_PER_LOOP - 1) / CYCLES_PER_LOOP
+           : 1;
+  }
+
+  /// Asynchronous transmit engine
+  // Timer ticks per microsecond
+  static constexpr unsigned int TX_TICKS_PER_US = IecHal::TICKS_PER_US;
+  // Transmit queue size (power of two)
+  static constexpr size_t TX_QUEUE_SIZE = 64;
+  // Transmit states
+  static constexpr uint8_t TX_IDLE      = 0;  // Engine stopped
+  static constexpr uint8_t TX_READY     = 1;  // Talker ready to send next byte
+  static constexpr uint8_t TX_RFD       = 2;  // Listener ready for data
+  static constexpr uint8_t TX_EOI_ACK   = 3;  // Listener acknowledged EOI
+  static constexpr uint8_t TX_EOI_DONE  = 4;  // Listener ready after EOI
+  static constexpr uint8_t TX_BIT_SETUP = 5;  // Prepare a bit on DIO
+  static constexpr uint8_t TX_BIT_DATA  = 6;  // Bit on DIO
+  static constexpr uint8_t TX_BIT_VALID = 7;  // Bit valid at CLK release
+  static constexpr uint8_t TX_FRAME     = 8;  // All bits sent
+  static constexpr uint8_t TX_ACK       = 9;  // Listener Data Accepted
+  static constexpr uint8_t TX_BURST_ACK = 10; // Fast serial byte sent
+  // Timer1 full periods in a TH listener hold-off
+  static constexpr uint8_t TX_HOLD_PERIODS = TIME_TH / (65536UL / TX_TICKS_PER_US);
+
+public:
+  // Conservative talker timing profile (typical bus timings)
+  static const IecTiming TimingConservative;
+
+  // Transmit interrupt handlers of the instance currently transmitting
+  static void (*volatile s_txTimerIsr)();
+  static void (*volatile s_txPinIsr)();
+};
+
+/// IEC line bit masks at Port D, fixed at compile time
+template<uint8_t SRQ, uint8_t ATN, uint8_t CLK, uint8_t DIO, uint8_t RST>
+struct IecPortD {
+  static constexpr uint8_t srqBit = 1 << SRQ;  // Service Request bit
+  static constexpr uint8_t rstBit = 1 << RST;  // Reset bit
+  static constexpr uint8_t clkBit = 1 << CLK;  // Clock bit
+  static constexpr uint8_t dioBit = 1 << DIO;  // Data I/O bit
+  static constexpr uint8_t atnBit = 1 << ATN;  // Attention bit
+};
+
+/// IEC line bit masks at Port D, set at run time
+struct IecPortDPins {
+  IecPortDPins(uint8_t srqPin,uint8_t atnPin,uint8_t clkPin,uint8_t dioPin,uint8_t rstPin)
+    : srqBit(1 << srqPin), rstBit(1 << rstPin), clkBit(1 << clkPin),
+      dioBit(1 << dioPin), atnBit(1 << atnPin) {};
+
+  uint8_t srqBit;  // Service Request bit
+  uint8_t rstBit;  // Reset bit
+  uint8_t clkBit;  // Clock bit
+  uint8_t dioBit;  // Data I/O bit
+  uint8_t atnBit;  // Attention bit
+};
+
+/// USB to Commodore IEC Serial Bus Interface protocol over a pin mask policy
+template<class Port>
+class IecSerialBase : public IecBus, protected Port {
+public:
+  IecSerialBase(const Port& port = Port());
+  ~IecSerialBase();
+
+  bool Command(uint8_t cmd);
+  bool Command(uint8_t cmd[], size_t length);
+
+  bool Talk(uint8_t pad);
+  bool Talk(uint8_t pad, uint8_t sad);
+
+  bool Listen(uint8_t pad);
+  bool Listen(uint8_t pad, uint8_t sad);
+  bool Listen(const uint8_t pad[], size_t count, uint8_t sad);
+
+  bool Untalk();
+  bool Unlisten();
+
+  void Reset();
+  bool Recover();
+  uint16_t Recoveries() { return m_recoveries; };
+
+  bool Send(uint8_t data, bool eoi = false);
+  bool Send(const uint8_t data[], size_t length, bool eoi = false);
+  bool Send(const char* str, bool eoi = false);
+  bool Get(uint8_t data[], size_t maxlength);
+  bool Get(char* str, size_t maxlength);
+  size_t Received() { return m_received; };
+
+  bool SendAsync(uint8_t data, bool eoi = false);
+  size_t SendAsync(const uint8_t data[], size_t length, bool eoi = false);
+  bool TxBusy() { return (m_txState != TX_IDLE); };
+  size_t TxFree() { return m_txQueue.Free(); };
+  bool TxFlush();
+  void TxAbort();
+
+  uint8_t Status() { return m_status; };
+  bool isOk() { return (m_status == STATUS_OK); };
+
+  void Calibrate(uint8_t bytes);
+  bool isCalibrating() { return (m_calBytes > 0); };
+  void SetTiming(const IecTiming& timing) { m_timing = timing; m_fallback = false; };
+  bool isFallback() { return m_fallback; };
+  const IecTiming& Timing() { return m_timing; };
+
+  void SetFastModes(uint8_t modes) { m_fastModes = modes; };
+  uint8_t FastMode() { return m_fastMode; };
+  bool isConservative();
+  unsigned int MaxReadyTime() { return m_maxReady; };
+  unsigned int MaxAcceptTime() { return m_maxAccept; };
+
+  const IecStats& Stats() { return m_stats; };
+  void ClearStats();
+
+private:
+  inline void Assert(uint8_t pins) __attribute__((always_inline));
+  inline void Release(uint8_t pins) __attribute__((always_inline));
+  void ReleaseAll();
+
+  inline bool isAsserted(uint8_t pins) __attribute__((always_inline));
+  inline bool isReleased(uint8_t pins) __attribute__((always_inline));
+  bool WaitAssertionOrTimeout(uint8_t pins, unsigned long timeout);
+  bool WaitReleaseOrTimeout(uint8_t pins, unsigned long timeout);
+
+  bool ListenCommand(bool fast);
+
+  bool Turnaround();
+  void SendBits(uint8_t data);
+  inline void SendBit(uint8_t bit, uint16_t prepare, uint16_t setup, uint16_t valid) __attribute__((always_inline));
+  void SendJiffyBits(uint8_t data, bool eoi);
+  void SendBurstBits(uint8_t data);
+  void AnnounceBurst();
+  inline void JiffyPair(uint8_t data, uint8_t clkMask, uint8_t dioMask) __attribute__((always_inline));
+  bool GetBits(uint8_t& data);
+  bool Receive(uint8_t& data, bool& eoi);
+
+  void TimingSample(unsigned int ready, unsigned int accept);
+  void Record(uint16_t histogram[], uint32_t time);
+  void TimerBegin();
+  void TimingFallback();
+
+  void TxStart();
+  void TxRun();
+  bool TxWait(uint8_t next, bool asserted, unsigned int timeout);
+  void TxDelay(uint8_t next, unsigned int time);
+  void TxStop();
+
+  void TxTimerEvent();
+  void TxPinEvent();
+  static void TxTimerIsr();
+  static void TxPinIsr();
+
+private:
+  using Port::srqBit;
+  using Port::rstBit;
+  using Port::clkBit;
+  using Port::dioBit;
+  using Port::atnBit;
+
+  // SendBits() delay loops of the conservative timing, used under ATN
+  static constexpr uint16_t LOOPS_PREPARE = DelayLoops(TIME_TS / 2, CYCLES_BIT_PREPARE);
+  static constexpr uint16_t LOOPS_SETUP = DelayLoops(TIME_TS - TIME_TS / 2, CYCLES_BIT_SETUP);
+  static constexpr uint16_t LOOPS_VALID = DelayLoops(TIME_TV, CYCLES_BIT_VALID);
+
+  uint8_t m_status;
+  size_t m_received;            // Bytes stored by last Get()
+
+  /// Talker timing and its calibration
+  IecTiming m_timing;           // Timing in use
+  uint8_t m_calBytes;           // Bytes left to calibrate
+  bool m_fallback;              // Conservative timing forced by a framing error
+  unsigned int m_maxReady;      // Max measured listener Ready for Data time [us]
+  unsigned int m_maxAccept;     // Max measured listener Data Accepted time [us]
+  bool m_underAtn;              // Sending commands, conservative timing for all devices
+
+  /// Fast serial protocol negotiation
+  uint8_t m_fastModes;          // Enabled fast protocols
+  uint8_t m_fastMode;           // Fast protocol of current listener
+  bool m_jiffyProbe;            // Detect JiffyDOS on next command byte
+  bool m_burstProbe;            // Announce fast serial host on next command
+
+  /// Bus error recovery
+  uint8_t m_listenCmd[2 * MAX_LISTENERS];  // Last LISTEN command sequence
+  uint8_t m_listenLength;       // Last LISTEN command length, 0 if unlistened
+  bool m_listenFast;            // Last LISTEN negotiated fast protocols
+  uint16_t m_recoveries;        // Bus resets done by Recover()
+
+  /// Instrumentation
+  IecStats m_stats;             // Handshake histograms and counters
+
+  /// Asynchronous transmit engine state
+  uint8_t m_txStorage[TX_QUEUE_SIZE];  // Transmit queue storage
+  RingBuffer m_txQueue;                // Bytes waiting transmission
+  volatile size_t m_txEoiLeft;         // Queued bytes up to the one signaled with EOI, 0 if none
+  volatile uint8_t m_txState;          // Current transmit state
+  uint8_t m_txData;                    // Byte in transmission, shifted out
+  uint8_t m_txByte;                    // Byte in transmission, kept for retry
+  bool m_txRetry;                      // Byte in transmission failed, resend first
+  uint8_t m_txHold;                    // Timer1 periods in listener hold-off
+  uint8_t m_txBit;                     // Bit count of byte in transmission
+  bool m_txLastEoi;                    // Byte in transmission is signaled with EOI
+  bool m_txWaitAsserted;               // Waiting DIO assertion, else release
+  bool m_txTimedOut;                   // Last wait ended by timeout
+  uint16_t m_txStamp;                  // Timer1 count at handshake start
+  unsigned int m_txReady;              // Ready for Data time of byte in transmission [us]
+
+  static IecSerialBase* s_txInstance;  // Instance served by the transmit interrupts
+};
+
+/// IEC Serial Bus Interface with pins fixed at compile time
+template<uint8_t SRQ, uint8_t ATN, uint8_t CLK, uint8_t DIO, uint8_t RST>
+class IecSerialT : public IecSerialBase< IecPortD<SRQ,ATN,CLK,DIO,RST> > {
+};
+
+/// IEC Serial Bus Interface with pins set at run time
+class IecSerial : public IecSerialBase<IecPortDPins> {
+public:
+  IecSerial(uint8_t srqPin,uint8_t atnPin,uint8_t clkPin,uint8_t dioPin,uint8_t rstPin)
+    : IecSerialBase<IecPortDPins>(IecPortDPins(srqPin, atnPin, clkPin, dioPin, rstPin)) {};
+};
+
+#include "iecserialimpl.h"
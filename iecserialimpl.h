@@ -0,0 +1,1214 @@
+/**************************************************************
+ * iecserialimpl.h
+ * IecSerialBase class template implementation
+ * A class for USB to Commodore IEC Serial Bus interface
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * REFERENCES:
+ * "IEC disected" 2008 by J. Derogee
+ * "VIC Revealed" 1982 by Nick Hampshire
+ * "COMPUTE!", How The VIC/64 Serial Bus Works, July 1983 by Jim Butterfield
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+#include "iechal.h"
+
+/**************************************************************
+ * IEC Serial Bus Commands:
+ *   0x20 + pad  = LISTEN
+ *   0x3F        = UNLISTEN
+ *   0x40 + pad  = TALK
+ *   0x5F        = UNTALK
+ *   0x60 + sad  = Secondary Address
+ * where:
+ *   pad = primary address   : 0 - 30 (0x00 - 0x1E)
+ *   sad = secondary address : 0 - 31 (0x00 - 0x1F)
+ *
+ * Several LISTEN commands under one ATN address several listeners.
+ * The handshake lines are wired-OR: Ready for Data is seen when the
+ * slowest listener is ready, so every byte reaches all of them.
+ *
+ * Bit transmission over DIO line:
+ *   bit=0 = low level = Asserted
+ *   bit=1 = high level = Released
+ * bit is valid on DIO line at the rising edge of CLK (CLK release)
+ *
+ * All bus signal lines are Open Collector TTL.
+ * External 1k ohm pull-up resistors are present at device's end.
+ *
+ * Asynchronous transmission:
+ *   SendAsync() queues bytes for a background talker state machine.
+ *   Timer1 (free running, prescaler 8) compare A interrupt times
+ *   bit clocking and handshake timeouts, and the port D pin change
+ *   interrupt on DIO detects listener handshake edges.
+ *   Timer1 PWM (pins 9 and 10) is not available while in use.
+ *   Port, timer and delay accesses go through IecHal (iechal.h). Other
+ *   boards have an equivalent timer and pin interrupt, and backends
+ *   with BIT_CLOCK clock the 8 bits of a byte out by themselves.
+ *
+ * Receiving:
+ *   After TALK and the turnaround the controller is the listener.
+ *   Get() releases DIO as Ready for Data once the talker releases CLK.
+ *   A talker that keeps CLK released over TIME_EOI_DETECT signals EOI,
+ *   acknowledged with a DIO pulse. Bits are read at CLK release and DIO
+ *   is asserted as Data Accepted when the talker asserts CLK again.
+ *   Standard protocol only, fast protocols are not negotiated by TALK.
+ *
+ * Bus errors:
+ *   Every handshake wait is bounded. The listener hold-off before
+ *   Ready for Data has no limit by spec, here it is TIME_TH. On an
+ *   error the engine stops keeping the failed byte and the queued
+ *   ones: Recover() resets the bus, commands the same listeners to
+ *   LISTEN and resends them, TxAbort() drops them.
+ *   Status() tells the cause:
+ *     STATUS_NOT_READY      : listener never got ready (jammed, off)
+ *     STATUS_FRAMMING_ERROR : listener did not accept a byte
+ *     STATUS_TIMEOUT        : EOI handshake timeout
+ *     STATUS_TALKER_TIMEOUT : device stopped clocking bits while talking
+ *     STATUS_NO_DEVICE      : no device answered ATN
+ *     STATUS_NO_LISTENER    : devices answered ATN, none addressed listens
+ *
+ * Instrumentation:
+ *   Handshake times are measured with Timer1 and counted in log2
+ *   histograms (IecStats): listener Ready for Data, Data Accepted, EOI
+ *   handshake and whole ATN command sequences. Long Ready for Data
+ *   waits of the synchronous Send() are measured with IecHal::Micros().
+ *
+ * Adaptive timing:
+ *   Calibrate() measures the listener Ready for Data and Data Accepted
+ *   response times over the next bytes sent, then tightens Tne and Ts
+ *   to twice the worst Data Accepted time, bounded by spec minimums and
+ *   the typical (conservative) values. A listener that confirms frames
+ *   quickly polls the bus often enough for shorter bit set-up times.
+ *   Any framing error restores the conservative profile.
+ *   Commands under ATN always use conservative timing.
+ *
+ * JiffyDOS fast serial (FAST_JIFFY):
+ *   Detection: the controller holds the last bit of the LISTEN byte
+ *   for TIME_JIFFY_DETECT. A JiffyDOS device asserts DIO meanwhile.
+ *   Transfer: after listener Ready for Data the talker releases CLK
+ *   (start) and then puts two bits at a time on CLK and DIO at fixed
+ *   times, no per bit handshake, bit=1 -> line released:
+ *     CLK,DIO = bit 4,5 / bit 6,7 / bit 3,1 / bit 2,0 / EOI flag
+ *   EOI flag: CLK released for EOI, asserted otherwise. DIO released.
+ *   Listener then asserts DIO as Data Accepted.
+ *   Interrupts are disabled during the ~60us bit pair sequence.
+ *
+ * CBM fast serial (FAST_BURST):
+ *   Negotiation: under ATN, before the LISTEN byte, the controller
+ *   announces itself as fast host with a byte clocked on SRQ, as the
+ *   C128 does. The first data byte then verifies the listener.
+ *   Transfer: after listener Ready for Data the talker clocks the byte
+ *   MSB first on DIO with SRQ (bit valid at SRQ release), CLK stays
+ *   released. A fast listener asserts DIO as Data Accepted within
+ *   TIME_BURST_ACK. A stock listener does not, and handles the CLK
+ *   silence as EOI signaling: the talker then completes the EOI
+ *   handshake and resends the byte with the standard protocol.
+ *   EOI bytes always use the standard protocol.
+ **************************************************************/
+
+template<class Port>
+IecSerialBase<Port>* IecSerialBase<Port>::s_txInstance = 0;
+
+/// Constructor.
+/// Define IEC pins in port D, releases all interface lines, and set status to Ok
+/// @param port is the IEC pin mask policy
+template<class Port>
+IecSerialBase<Port>::IecSerialBase(const Port& port)
+          : Port(port), m_status(STATUS_OK), m_received(0), m_timing(TimingConservative),
+            m_calBytes(0), m_fallback(false), m_maxReady(0), m_maxAccept(0),
+            m_underAtn(false), m_fastModes(FAST_NONE), m_fastMode(FAST_NONE),
+            m_jiffyProbe(false), m_burstProbe(false),
+            m_listenLength(0), m_listenFast(false), m_recoveries(0),
+            m_txQueue(m_txStorage, TX_QUEUE_SIZE),
+            m_txEoiLeft(0), m_txState(TX_IDLE), m_txRetry(false) {
+  ClearStats();
+  IecHal::Begin(srqBit|rstBit|clkBit|dioBit|atnBit);
+  ReleaseAll();
+}
+
+/// Destructor. Releases all interface lines
+template<class Port>
+IecSerialBase<Port>::~IecSerialBase() {
+  ReleaseAll();
+}
+
+/// Send a byte command to IEC serial bus
+/// @param cmd  command byte to send
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Command(uint8_t cmd) {
+  TxFlush();
+  TimerBegin();
+  uint16_t t0 = IecHal::TimerCount();
+  m_status = STATUS_OK;
+
+  m_underAtn = true;
+  Release(dioBit);
+  Assert(atnBit);  // Start of a command
+  Assert(clkBit);
+  // Wait ATN device response on DIO line
+  if (WaitAssertionOrTimeout(dioBit, TIME_TAT)) {
+    // Timeout Error
+    m_status = STATUS_NO_DEVICE;
+    m_underAtn = false;
+    m_jiffyProbe = false;
+    m_burstProbe = false;
+    ReleaseAll();
+    return false;  // no devices
+  }
+  // Device is present, send command to it
+  AnnounceBurst();
+  Send(cmd);
+  // End of command
+  m_underAtn = false;
+  IecHal::DelayMicros(TIME_TR);  // Time to Release ATN
+  Release(atnBit);
+  IecHal::DelayMicros(TIME_TTK);
+  Record(m_stats.command, (uint16_t)(IecHal::TimerCount() - t0) / TX_TICKS_PER_US);
+
+  return isOk();
+}
+
+/// Send n bytes command to IEC serial bus.
+/// @param cmd[]  is an array of byte command to send
+/// @param length number of bytes in cmd[] array
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Command(uint8_t cmd[], size_t length) {
+  TxFlush();
+  TimerBegin();
+  uint16_t t0 = IecHal::TimerCount();
+  m_status = STATUS_OK;
+  m_underAtn = true;
+  Release(dioBit);
+  Assert(atnBit);  // Start of commands
+  Assert(clkBit);
+  // Wait ATN device response on DIO line
+  if (WaitAssertionOrTimeout(dioBit, TIME_TAT)) {
+    // Timeout Error
+    m_status = STATUS_NO_DEVICE;
+    m_underAtn = false;
+    m_jiffyProbe = false;
+    m_burstProbe = false;
+    ReleaseAll();
+    return false;  // no devices
+  }
+  // Device is present, send commands to it
+  AnnounceBurst();
+  Send(cmd, length);
+  // End of command
+  m_underAtn = false;
+  IecHal::DelayMicros(TIME_TR);  // Time to Release ATN
+  Release(atnBit);
+  IecHal::DelayMicros(TIME_TTK);
+  Record(m_stats.command, (uint16_t)(IecHal::TimerCount() - t0) / TX_TICKS_PER_US);
+
+  return isOk();
+}
+
+/// Command a device to TALK.
+/// @param pad  Device Primary Address
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Talk(uint8_t pad) {
+  if (Command(CMD_TALK | pad)) {
+    // TALK command ok, gives transmission control to device
+    return Turnaround();
+  }
+  return false;  // error
+}
+
+/// Command a device to TALK followed by a secondary address.
+/// @param pad  Device Primary Address
+/// @param sad  Device Secondary Address
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Talk(uint8_t pad, uint8_t sad) {
+  uint8_t data[2] = { (uint8_t)(CMD_TALK | pad), (uint8_t)(CMD_SECONDARY | sad) };
+  if (Command(data, 2)) {
+    // TALK command ok, gives transmission control to device
+    return Turnaround();
+  }
+  return false;  // error
+}
+
+/// Command a device to LISTEN.
+/// @param pad  Device Primary Address
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Listen(uint8_t pad) {
+  TxAbort();
+  m_listenCmd[0] = CMD_LISTEN | pad;
+  m_listenLength = 1;
+  return ListenCommand(true);
+}
+
+/// Command a device to LISTEN followed by a secondary address.
+/// @param pad  Device Primary Address
+/// @param sad  Device Secondary Address
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Listen(uint8_t pad, uint8_t sad) {
+  TxAbort();
+  m_listenCmd[0] = CMD_LISTEN | pad;
+  m_listenCmd[1] = CMD_SECONDARY | sad;
+  m_listenLength = 2;
+  return ListenCommand(true);
+}
+
+/// Command several devices to LISTEN, each followed by the secondary address,
+/// in a single ATN sequence. Bytes sent afterwards reach all of them.
+/// Fast protocols are not negotiated, listeners share the handshake lines.
+/// @param pad[]  Device Primary Addresses
+/// @param count  number of devices, up to MAX_LISTENERS
+/// @param sad    Device Secondary Address
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Listen(const uint8_t pad[], size_t count, uint8_t sad) {
+  TxAbort();
+  if (count > MAX_LISTENERS) {
+    count = MAX_LISTENERS;
+  }
+  for (size_t i = 0; i < count; i++) {
+    m_listenCmd[2 * i] = CMD_LISTEN | pad[i];
+    m_listenCmd[2 * i + 1] = CMD_SECONDARY | sad;
+  }
+  m_listenLength = 2 * count;
+  return ListenCommand(false);
+}
+
+/// Send the stored LISTEN command sequence.
+/// Every device answers ATN, so presence is checked after ATN release:
+/// an addressed listener keeps DIO asserted while CLK is asserted, the
+/// other devices release it (Kernal "device not present" test).
+/// @param fast if true negotiates fast protocol during LISTEN byte
+/// @return true if OK, false if error or no addressed listener
+template<class Port>
+bool IecSerialBase<Port>::ListenCommand(bool fast) {
+  m_listenFast = fast;
+  m_fastMode = FAST_NONE;
+  m_jiffyProbe = fast && (m_fastModes & FAST_JIFFY);
+  m_burstProbe = fast && (m_fastModes & FAST_BURST);
+  if (!Command(m_listenCmd, m_listenLength)) {
+    return false;
+  }
+  if (isReleased(dioBit)) {
+    m_status = STATUS_NO_LISTENER;
+    m_fastMode = FAST_NONE;
+    ReleaseAll();
+    return false;
+  }
+  return true;
+}
+
+/// Command all devices to stop talking.
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Untalk() {
+  Command(CMD_UNTALK);
+  ReleaseAll();
+  return isOk();  // true if Ok
+}
+
+/// Command all devices to stop listening.
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Unlisten() {
+  TxAbort();
+  Command(CMD_UNLISTEN);
+  m_listenLength = 0;
+  m_fastMode = FAST_NONE;
+  ReleaseAll();
+  return isOk();  // true if Ok
+}
+
+/// Send a 1ms Reset pulse on RST line.
+template<class Port>
+void IecSerialBase<Port>::Reset() {
+  ReleaseAll();
+  Assert(rstBit);
+  IecHal::DelayMicros(1000);
+  Release(rstBit);
+}
+
+/// Recover from a bus error while listening: reset the bus, command the
+/// last listeners to LISTEN again and resume background transmission
+/// from the byte that failed. Takes TIME_RESET_BOOT for devices to start.
+/// @return true if OK, false if no listener or device not found
+template<class Port>
+bool IecSerialBase<Port>::Recover() {
+  if (m_listenLength == 0) {
+    return false;  // nobody was listening
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    TxStop();
+  }
+  Reset();
+  IecHal::Delay(TIME_RESET_BOOT);
+  m_recoveries++;
+  if (!ListenCommand(m_listenFast)) {
+    return false;
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (m_txRetry || !m_txQueue.isEmpty()) {
+      TxStart();
+    }
+  }
+  return true;
+}
+
+/// Send a byte to current Listening device
+/// @param data is the byte to send
+/// @param eoi if true signals EOI with the byte
+/// @return true if OK, false if error
+// on entering and exiting: CLK & DIO are asserted
+template<class Port>
+bool IecSerialBase<Port>::Send(uint8_t data, bool eoi) {
+  // Wait queued asynchronous transmission
+  if (!TxFlush()) {
+    return false;
+  }
+  m_status = STATUS_OK;
+
+  Release(clkBit);  // Talker Ready to Send
+  unsigned long t0 = IecHal::Micros();
+  // Wait Listener Ready for Data (TH)
+  if (WaitReleaseOrTimeout(dioBit, TIME_TH)) {
+    m_status = STATUS_NOT_READY;
+    return false;
+  }
+  unsigned long ready = IecHal::Micros() - t0;
+
+  bool jiffy = (m_fastMode == FAST_JIFFY && !m_underAtn);
+  bool burst = (m_fastMode == FAST_BURST && !m_underAtn && !eoi);
+  if (jiffy) {
+    // JiffyDOS transfer, EOI signaled along with data
+    SendJiffyBits(data, eoi);
+  } else {
+    if (burst) {
+      // Fast serial transfer
+      SendBurstBits(data);
+      if (WaitAssertionOrTimeout(dioBit, TIME_BURST_ACK)) {
+        // Stock listener, it takes the CLK silence as EOI
+        m_fastMode = FAST_NONE;
+        m_status = STATUS_OK;
+        burst = false;
+        eoi = true;
+      }
+    }
+    if (burst) {
+      // Listener already asserting DIO: Data Accepted
+    } else if (eoi) {
+      uint16_t eoiStart = IecHal::TimerCount();
+      // delay > 200us for EOI signaling (just wait device acknowledge it)
+      WaitAssertionOrTimeout(dioBit, TIME_TYE);  // EOI response time
+      // requires listener EOI acknowledge
+      WaitReleaseOrTimeout(dioBit, TIME_TEI);
+      if (!m_underAtn) {
+        Record(m_stats.eoi, (uint16_t)(IecHal::TimerCount() - eoiStart) / TX_TICKS_PER_US);
+      }
+      IecHal::DelayMicros(TIME_TRY);  // Talker response limit
+    } else {
+      IecHal::DelayMicros(m_underAtn ? TIME_TNE : m_timing.tne);  // non-EOI response to RFD
+    }
+    if (!burst) {
+      // Here CLK and DIO are released. Ready for bit stream transmission
+      SendBits(data);
+    }
+  }
+  // Wait Listener Data Accepted Handshake or framming error
+  uint16_t stamp = IecHal::TimerCount();
+  if (WaitAssertionOrTimeout(dioBit, TIME_TF)) {
+    // Timeout
+    m_status = STATUS_FRAMMING_ERROR;
+    m_stats.framingErrors++;
+    TimingFallback();
+  } else if (!m_underAtn) {
+    unsigned int accept = (uint16_t)(IecHal::TimerCount() - stamp) / TX_TICKS_PER_US;
+    TimingSample(ready, accept);
+    Record(m_stats.ready, ready);
+    Record(m_stats.accept, accept);
+    m_stats.bytes++;
+  }
+  if (!jiffy && !burst) {
+    IecHal::DelayMicros(m_underAtn ? TIME_TBB : m_timing.tbb);  // Time between bytes
+  }
+
+  return isOk();
+}
+
+/// Send a byte array to current Listening device
+/// @param data[] array of bytes to send
+/// @param length is the number of bytes on array to send
+/// @param eoi if true signal EOI with the last byte
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Send(const uint8_t data[], size_t length, bool eoi) {
+  bool lasteoi = false;
+  for (size_t i = 0; i < length; i++) {
+    lasteoi = eoi && (i == length-1);  // last byte and EOI
+    if (!Send(data[i], lasteoi)) {
+      break;
+    }
+  }
+  return isOk();
+}
+
+/// Send a zero-terminated string to current Listening device
+/// @param *str is a pointer to a zero terminated string
+/// @param eoi if true signals EOI with the last character
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Send(const char* str, bool eoi) {
+  size_t len = strlen(str);
+  return Send(str, len, eoi);
+}
+
+/// Get bytes from current Talking device until EOI or maxlength.
+/// Received() tells the number of bytes stored.
+/// @param data is the byte array to store incoming data
+/// @param maxlength is the array max capacity
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Get(uint8_t data[], size_t maxlength) {
+  m_status = STATUS_OK;
+  m_received = 0;
+  bool eoi = false;
+  while (!eoi && m_received < maxlength) {
+    if (!Receive(data[m_received], eoi)) {
+      break;
+    }
+    m_received++;
+  }
+  return isOk();
+}
+
+/// Listener Get a string from current Talking device until CR or EOI or maxlength
+/// The string is zero terminated, CR is not stored.
+/// @param *str is a pointer to a character array to receive incoming string
+/// @param maxlength is the character array max capacity
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::Get(char* str, size_t maxlength) {
+  m_status = STATUS_OK;
+  m_received = 0;
+  if (maxlength == 0) {
+    return isOk();
+  }
+  bool eoi = false;
+  while (!eoi && m_received < maxlength - 1) {
+    uint8_t c;
+    if (!Receive(c, eoi) || c == '\r') {
+      break;
+    }
+    str[m_received++] = c;
+  }
+  str[m_received] = '\0';
+  return isOk();
+}
+
+/// Start talker timing calibration over the next bytes sent.
+/// Conservative timing is used while calibrating.
+/// @param bytes is the number of bytes to measure
+template<class Port>
+void IecSerialBase<Port>::Calibrate(uint8_t bytes) {
+  TxFlush();
+  m_timing = TimingConservative;
+  m_fallback = false;
+  m_maxReady = 0;
+  m_maxAccept = 0;
+  m_calBytes = bytes;
+}
+
+/// Check if conservative timing is in use
+/// @return true if timing profile is the conservative one
+template<class Port>
+bool IecSerialBase<Port>::isConservative() {
+  return (memcmp(&m_timing, &TimingConservative, sizeof(IecTiming)) == 0);
+}
+
+/// Record listener handshake times of a byte while calibrating.
+/// Tune timing after the last calibration byte.
+/// @param ready is the listener Ready for Data time [us]
+/// @param accept is the listener Data Accepted time [us]
+template<class Port>
+void IecSerialBase<Port>::TimingSample(unsigned int ready, unsigned int accept) {
+  if (m_calBytes == 0) {
+    return;  // not calibrating
+  }
+  m_maxReady = max(m_maxReady, ready);
+  m_maxAccept = max(m_maxAccept, accept);
+  if (--m_calBytes > 0) {
+    return;
+  }
+  // Calibration done. Twice the worst response within spec limits.
+  // Tv and Tbb keep their conservative values, the spec minimums
+  unsigned int fast = 2 * m_maxAccept;
+  m_timing.tne = constrain(fast, TIME_TNE_MIN, TIME_TNE);
+  m_timing.ts  = constrain(fast, TIME_TS_MIN, TIME_TS);
+  m_timing.tv  = TIME_TV;
+  m_timing.tbb = TIME_TBB;
+}
+
+/// Restore conservative timing and standard protocol after a framing error.
+/// isFallback() tells the profile must not be stored as a tuned one.
+template<class Port>
+void IecSerialBase<Port>::TimingFallback() {
+  m_timing = TimingConservative;
+  m_fallback = true;
+  m_calBytes = 0;
+  m_fastMode = FAST_NONE;
+}
+
+/// Clear handshake histograms and counters
+template<class Port>
+void IecSerialBase<Port>::ClearStats() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    memset(&m_stats, 0, sizeof(m_stats));
+  }
+}
+
+/// Count a handshake time in a log2 histogram
+/// @param histogram[] is the histogram to update
+/// @param time is the handshake time [us]
+template<class Port>
+void IecSerialBase<Port>::Record(uint16_t histogram[], uint32_t time) {
+  uint8_t bucket = 0;
+  while (time > 1 && bucket < IecStats::BUCKETS - 1) {
+    time >>= 1;
+    bucket++;
+  }
+  if (histogram[bucket] < 0xFFFF) {
+    histogram[bucket]++;
+  }
+}
+
+/// Run Timer1 free, the time base of handshake timing
+template<class Port>
+void IecSerialBase<Port>::TimerBegin() {
+  IecHal::TimerBegin();
+}
+
+/// Queue a byte for background transmission to current Listening device.
+/// The byte queued with EOI keeps it when more bytes follow in the queue.
+/// Only one EOI byte is queued at a time: another one is refused, as on a
+/// full queue, until the first is sent.
+/// @param data is the byte to send
+/// @param eoi if true signals EOI with the byte
+/// @return true if queued, false if queue full or on transmission error
+template<class Port>
+bool IecSerialBase<Port>::SendAsync(uint8_t data, bool eoi) {
+  if (!isOk()) {
+    return false;  // previous transmission error
+  }
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (eoi && m_txEoiLeft > 0) {
+      return false;  // single EOI mark, wait the queued EOI byte
+    }
+    if (!m_txQueue.Put(data)) {
+      return false;  // queue full
+    }
+    if (eoi) {
+      m_txEoiLeft = m_txQueue.Count();  // position of this byte
+    }
+    if (m_txState == TX_IDLE) {
+      TxStart();  // Start the engine on this byte
+    }
+  }
+  return true;
+}
+
+/// Queue as many bytes of an array as fit for background transmission.
+/// @param data[] array of bytes to send
+/// @param length is the number of bytes on array to send
+/// @param eoi if true signal EOI with the last byte, if it was queued
+/// @return number of bytes queued, stops on full queue or transmission error
+template<class Port>
+size_t IecSerialBase<Port>::SendAsync(const uint8_t data[], size_t length, bool eoi) {
+  size_t i;
+  for (i = 0; i < length; i++) {
+    if (!SendAsync(data[i], eoi && (i == length-1))) {
+      break;
+    }
+  }
+  return i;
+}
+
+/// Wait background transmission of all queued bytes.
+/// @return true if OK, false if error
+template<class Port>
+bool IecSerialBase<Port>::TxFlush() {
+  while (TxBusy()) {
+    IecHal::Spin([this]() { return TxBusy(); });  // engine waits are all bounded
+  }
+  return isOk();
+}
+
+/// Drop bytes kept after a transmission error, failed and queued ones
+template<class Port>
+void IecSerialBase<Port>::TxAbort() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (m_txState == TX_IDLE) {
+      m_txQueue.Clear();
+      m_txEoiLeft = 0;
+      m_txRetry = false;
+    }
+  }
+}
+
+/// Start the transmit state machine. Called with interrupts disabled.
+template<class Port>
+void IecSerialBase<Port>::TxStart() {
+  s_txInstance = this;
+  s_txTimerIsr = &TxTimerIsr;
+  s_txPinIsr = &TxPinIsr;
+  TimerBegin();
+  m_txState = TX_READY;
+  TxRun();
+}
+
+/// Run the transmit state machine until it has to wait for an event.
+/// Called with interrupts disabled.
+template<class Port>
+void IecSerialBase<Port>::TxRun() {
+  for (;;) {
+    switch (m_txState) {
+      case TX_READY:
+        if (m_txRetry) {
+          m_txRetry = false;  // Resend failed byte after recovery
+        } else if (m_txQueue.isEmpty()) {
+          TxStop();  // All queued bytes sent
+          return;
+        } else {
+          m_txByte = m_txQueue.Get();
+          m_txLastEoi = (m_txEoiLeft == 1);
+          if (m_txEoiLeft > 0) {
+            m_txEoiLeft--;
+          }
+        }
+        m_txData = m_txByte;
+        m_txBit = 0;
+        Release(clkBit);  // Talker Ready to Send
+        m_txStamp = IecHal::TimerCount();
+        // Wait Listener Ready for Data, bounded hold-off (TH)
+        if (!TxWait(TX_RFD, false, 0)) {
+          return;
+        }
+        break;
+      case TX_RFD:
+        if (m_txTimedOut) {
+          // Listener jammed or powered off, keep byte for Recover()
+          m_status = STATUS_NOT_READY;
+          m_txRetry = true;
+          TxStop();
+          return;
+        }
+        m_txReady = (uint16_t)(IecHal::TimerCount() - m_txStamp) / TX_TICKS_PER_US;
+        Record(m_stats.ready, ((uint32_t)m_txHold << 16 | (uint16_t)(IecHal::TimerCount() - m_txStamp)) / TX_TICKS_PER_US);
+        if (m_fastMode == FAST_JIFFY) {
+          // JiffyDOS transfer, EOI signaled along with data
+          SendJiffyBits(m_txData, m_txLastEoi);
+          m_txStamp = IecHal::TimerCount();
+          if (!TxWait(TX_ACK, true, TIME_TF)) {
+            return;
+          }
+        } else if (m_fastMode == FAST_BURST && !m_txLastEoi) {
+          // Fast serial transfer
+          SendBurstBits(m_txData);
+          m_txStamp = IecHal::TimerCount();
+          if (!TxWait(TX_BURST_ACK, true, TIME_BURST_ACK)) {
+            return;
+          }
+        } else if (m_txLastEoi) {
+          // delay > 200us for EOI signaling (just wait device acknowledge it)
+          m_txStamp = IecHal::TimerCount();
+          if (!TxWait(TX_EOI_ACK, true, TIME_TYE)) {
+            return;
+          }
+        } else {
+          TxDelay(TX_BIT_SETUP, m_timing.tne);  // non-EOI response to RFD
+          return;
+        }
+        break;
+      case TX_BURST_ACK:
+        if (m_txTimedOut) {
+          // Stock listener, it takes the CLK silence as EOI
+          m_fastMode = FAST_NONE;
+          m_txStamp = IecHal::TimerCount();
+          if (!TxWait(TX_EOI_ACK, true, TIME_TYE)) {
+            return;
+          }
+        } else {
+          m_txState = TX_ACK;  // Data Accepted
+        }
+        break;
+      case TX_EOI_ACK:
+        if (m_txTimedOut) {
+          m_status = STATUS_TIMEOUT;
+        }
+        // requires listener EOI acknowledge
+        if (!TxWait(TX_EOI_DONE, false, TIME_TEI)) {
+          return;
+        }
+        break;
+      case TX_EOI_DONE:
+        if (m_txTimedOut) {
+          m_status = STATUS_TIMEOUT;
+        }
+        Record(m_stats.eoi, (uint16_t)(IecHal::TimerCount() - m_txStamp) / TX_TICKS_PER_US);
+        TxDelay(TX_BIT_SETUP, TIME_TRY);  // Talker response limit
+        return;
+      case TX_BIT_SETUP:
+        if (IecHal::BIT_CLOCK) {
+          // Backend clocks the 8 bits out, timer event when done
+          m_txState = TX_FRAME;
+          IecHal::PinWatchOff();
+          IecHal::BitClock(clkBit, dioBit, m_txData, m_timing.ts, m_timing.tv);
+          return;
+        }
+        Assert(clkBit);  // preparing LSB bit to send
+        TxDelay(TX_BIT_DATA, m_timing.ts/2);
+        return;
+      case TX_BIT_DATA:
+        if (m_txData & 1) {
+          Release(dioBit);  // bit=1 -> Release DIO (high)
+        } else {
+          Assert(dioBit);  // bit=0 -> Assert DIO (low)
+        }
+        m_txData >>= 1;  // Move bits right for next bit
+        TxDelay(TX_BIT_VALID, m_timing.ts/2);
+        return;
+      case TX_BIT_VALID:
+        Release(clkBit);  // bit valid
+        m_txBit++;
+        TxDelay((m_txBit < 8) ? TX_BIT_SETUP : TX_FRAME, m_timing.tv);
+        return;
+      case TX_FRAME:
+        // End of a byte transmission
+        Release(dioBit);
+        Assert(clkBit);
+        m_txStamp = IecHal::TimerCount();
+        // Wait Listener Data Accepted Handshake or framming error
+        if (!TxWait(TX_ACK, true, TIME_TF)) {
+          return;
+        }
+        break;
+      case TX_ACK:
+        if (m_txTimedOut) {
+          m_status = STATUS_FRAMMING_ERROR;
+          m_stats.framingErrors++;
+          TimingFallback();
+        } else {
+          unsigned int accept = (uint16_t)(IecHal::TimerCount() - m_txStamp) / TX_TICKS_PER_US;
+          TimingSample(m_txReady, accept);
+          Record(m_stats.accept, accept);
+          m_stats.bytes++;
+        }
+        if (!isOk()) {
+          // Abort transmission, keep bytes for Recover() or TxAbort()
+          m_txRetry = true;
+          TxStop();
+          return;
+        }
+        if (m_fastMode != FAST_NONE) {
+          m_txState = TX_READY;  // Listener Ready for Data is the only gap
+          break;
+        }
+        TxDelay(TX_READY, m_timing.tbb);  // Time between bytes
+        return;
+      default:
+        TxStop();
+        return;
+    }
+  }
+}
+
+/// Wait for a DIO line state change, with optional timeout
+/// @param next is the state to run when wait ends
+/// @param asserted if true waits DIO assertion, else DIO release
+/// @param timeout is the time wait limit in microsseconds, 0 for the TH
+///                listener hold-off, counted in Timer1 full periods
+/// @return true if the line is already at requested state, no wait needed
+template<class Port>
+bool IecSerialBase<Port>::TxWait(uint8_t next, bool asserted, unsigned int timeout) {
+  m_txState = next;
+  m_txTimedOut = false;
+  m_txHold = 0;
+  if (asserted ? isAsserted(dioBit) : isReleased(dioBit)) {
+    return true;  // Run next state right now
+  }
+  m_txWaitAsserted = asserted;
+  // Pin change interrupt on DIO
+  IecHal::PinWatch(dioBit);
+  // Timeout on Timer1 compare A
+  IecHal::TimerAlarm(IecHal::TimerCount() + timeout * TX_TICKS_PER_US);
+  return false;
+}
+
+/// Schedule next state after a delay
+/// @param next is the state to run after the delay
+/// @param time is the delay in microsseconds
+template<class Port>
+void IecSerialBase<Port>::TxDelay(uint8_t next, unsigned int time) {
+  m_txState = next;
+  IecHal::PinWatchOff();
+  IecHal::TimerAlarm(IecHal::TimerCount() + time * TX_TICKS_PER_US);
+}
+
+/// Stop transmit state machine and its interrupts
+/// on exiting: CLK & DIO are asserted as after a synchronous Send()
+template<class Port>
+void IecSerialBase<Port>::TxStop() {
+  IecHal::PinWatchOff();
+  IecHal::TimerAlarmOff();
+  m_txState = TX_IDLE;
+}
+
+/// Timer1 compare A event: end of a delay or of a wait timeout
+template<class Port>
+void IecSerialBase<Port>::TxTimerIsr() {
+  s_txInstance->TxTimerEvent();
+}
+
+/// DIO pin change event
+template<class Port>
+void IecSerialBase<Port>::TxPinIsr() {
+  s_txInstance->TxPinEvent();
+}
+
+/// Timer1 compare A event handler
+template<class Port>
+void IecSerialBase<Port>::TxTimerEvent() {
+  if (IecHal::isPinWatched()) {
+    // Waiting DIO change
+    if (m_txState == TX_RFD && ++m_txHold < TX_HOLD_PERIODS) {
+      return;  // Listener hold-off, next match one Timer1 period later
+    }
+    // Timeout
+    IecHal::TimerAlarmOff();
+    IecHal::PinWatchOff();
+    m_txTimedOut = true;
+  } else {
+    IecHal::TimerAlarmOff();
+  }
+  TxRun();
+}
+
+/// DIO pin change event handler
+template<class Port>
+void IecSerialBase<Port>::TxPinEvent() {
+  if (m_txWaitAsserted ? isReleased(dioBit) : isAsserted(dioBit)) {
+    return;  // Not the awaited edge
+  }
+  IecHal::PinWatchOff();
+  IecHal::TimerAlarmOff();
+  TxRun();
+}
+
+/// Assert IEC bus lines by pulling it low
+/// @param pins are the bits on PORTD to assert (low level)
+template<class Port>
+void IecSerialBase<Port>::Assert(uint8_t pins) {
+  IecHal::Assert(pins);
+}
+
+/// Release a IEC bus lines by switching to input mode
+/// @param pins are the bits on PORTD to release (high level)
+template<class Port>
+void IecSerialBase<Port>::Release(uint8_t pins) {
+  IecHal::Release(pins);
+}
+
+/// Release all IEC bus lines by switching to input mode
+template<class Port>
+void IecSerialBase<Port>::ReleaseAll() {
+  Release(srqBit|rstBit|clkBit|dioBit|atnBit);
+}
+
+/// Check if lines are asserted (low level)
+/// @param pins are the bits on PORTD to compare to zero
+/// @return True if all indicated lines are asserted (low level)
+template<class Port>
+bool IecSerialBase<Port>::isAsserted(uint8_t pins) {
+  return ((IecHal::Lines() & pins) == 0);
+}
+
+/// Check if lineas are released (high level)
+/// @param pins are the bits on PORTD to compare to high
+/// @return True if any of the indicated line is released (high level)
+template<class Port>
+bool IecSerialBase<Port>::isReleased(uint8_t pins) {
+  return ((IecHal::Lines() & pins) != 0);
+}
+
+/// Wait for line assertion with timeout
+/// @param pins are the bits on PORTD to monitor
+/// @param timeout is the time wait limit in microsseconds
+/// @return True on timeout without line assertion
+template<class Port>
+bool IecSerialBase<Port>::WaitAssertionOrTimeout(uint8_t pins, unsigned long timeout) {
+  unsigned long initialTime = IecHal::Micros();  // start chronometer
+  while ( isReleased(pins) ) {
+    if ((IecHal::Micros() - initialTime) > timeout) {
+      // Timeout
+      m_status = STATUS_TIMEOUT;
+      return true;
+    }
+  }
+  // No Timeout
+  return false;
+}
+
+/// Wait for line release with timeout
+/// @param pins are the bits on PORTD to monitor
+/// @param timeout is the time wait limit in microsseconds
+/// @return True on timeout without line releasing
+template<class Port>
+bool IecSerialBase<Port>::WaitReleaseOrTimeout(uint8_t pins, unsigned long timeout) {
+  unsigned long initialTime = IecHal::Micros();  // start chronometer
+  while ( isAsserted(pins) ) {
+    if ((IecHal::Micros() - initialTime) > timeout) {
+      // Timeout
+      m_status = STATUS_TIMEOUT;
+      return true;
+    }
+  }
+  // No Timeout
+  return false;  // no timeout
+}
+
+/// Turnaround maneuver needed immediatly after a TALK command.
+/// Controller gives transmission control to device.
+/// @return True if ok, false on error
+template<class Port>
+bool IecSerialBase<Port>::Turnaround() {
+  // Immediatly after ATN release, device is listening:
+  //   device is asserting DIO and controller is asserting CLK
+  IecHal::DelayMicros(TIME_TTK);  // Talk-Attention Release time
+  Assert(dioBit);
+  Release(clkBit);
+  IecHal::DelayMicros(TIME_TDC);  // Talk-Attention Acknowledge time
+  // Device must detect CLK release and assert CLK, and also release DIO
+  if (WaitAssertionOrTimeout(clkBit, 1000)) {
+    // Turnaround acknowledge timeout error
+    return false;
+  }
+  IecHal::DelayMicros(TIME_TDA);  // Talk-Attention Acknowledge Hold time
+  return true;  // Ok
+}
+
+/// Send a 8-bit stream to serial IEC bus DIO line, no handshake, LSB first.
+/// Cycle counted and unrolled: bit phase delays are loop counts taken once
+/// per byte, less the cycles of the line accesses, so each bit lasts its
+/// TS and TV times and not more.
+/// Probes for a JiffyDOS device on bit 7 when requested by Listen().
+/// @param data  is the byte to send
+/// @note CLK & DIO lines must be released before calling this routine
+template<class Port>
+void IecSerialBase<Port>::SendBits(uint8_t data) {
+  uint16_t prepare = LOOPS_PREPARE;
+  uint16_t setup = LOOPS_SETUP;
+  uint16_t valid = LOOPS_VALID;
+  if (!m_underAtn) {
+    // Tuned timing is set at run time
+    prepare = DelayLoops(m_timing.ts / 2, CYCLES_BIT_PREPARE);
+    setup = DelayLoops(m_timing.ts - m_timing.ts / 2, CYCLES_BIT_SETUP);
+    valid = DelayLoops(m_timing.tv, CYCLES_BIT_VALID);
+  }
+  SendBit(data & 0x01, prepare, setup, valid);
+  SendBit(data & 0x02, prepare, setup, valid);
+  SendBit(data & 0x04, prepare, setup, valid);
+  SendBit(data & 0x08, prepare, setup, valid);
+  SendBit(data & 0x10, prepare, setup, valid);
+  SendBit(data & 0x20, prepare, setup, valid);
+  SendBit(data & 0x40, prepare, setup, valid);
+  if (m_jiffyProbe) {
+    // Hold last bit, JiffyDOS device answers asserting DIO
+    m_jiffyProbe = false;
+    Assert(clkBit);
+    Release(dioBit);
+    if (!WaitAssertionOrTimeout(dioBit, TIME_JIFFY_DETECT)) {
+      m_fastMode = FAST_JIFFY;
+      WaitReleaseOrTimeout(dioBit, TIME_JIFFY_DETECT);
+    }
+    m_status = STATUS_OK;  // no answer is not an error
+  }
+  SendBit(data & 0x80, prepare, setup, valid);
+  // End of a byte transmission
+  Release(dioBit);
+  Assert(clkBit);
+}
+
+/// Clock one bit out on DIO. Interrupts are masked from the DIO change
+/// to the CLK release only, the edges that frame the bit set-up time;
+/// an interrupt elsewhere just stretches a phase past its minimum.
+/// @param bit is the bit value, zero or not
+/// @param prepare, setup, valid are the phase delay loops, see DelayLoops()
+template<class Port>
+void IecSerialBase<Port>::SendBit(uint8_t bit, uint16_t prepare, uint16_t setup, uint16_t valid) {
+  Assert(clkBit);  // preparing bit to send
+  IecHal::DelayLoop(prepare);
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (bit) {
+      Release(dioBit);  // bit=1 -> Release DIO (high)
+    } else {
+      Assert(dioBit);  // bit=0 -> Assert DIO (low)
+    }
+    IecHal::DelayLoop(setup);
+    Release(clkBit);  // bit valid
+  }
+  IecHal::DelayLoop(valid);
+}
+
+/// Put a JiffyDOS bit pair on CLK and DIO lines
+/// @param data is the byte in transmission
+/// @param clkMask selects the data bit sent on CLK
+/// @param dioMask selects the data bit sent on DIO
+template<class Port>
+void IecSerialBase<Port>::JiffyPair(uint8_t data, uint8_t clkMask, uint8_t dioMask) {
+  if (data & clkMask) { Release(clkBit); } else { Assert(clkBit); }
+  if (data & dioMask) { Release(dioBit); } else { Assert(dioBit); }
+}
+
+/// Send a byte with JiffyDOS timing, two bits at a time, no handshake.
+/// @param data  is the byte to send
+/// @param eoi if true signals EOI with the byte
+/// @note CLK & DIO lines are released on entry, and on exit DIO is
+///       released and CLK asserted, as after SendBits()
+template<class Port>
+void IecSerialBase<Port>::SendJiffyBits(uint8_t data, bool eoi) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // CLK already released by Ready to Send: start of transfer
+    IecHal::DelayMicros(TIME_JIFFY_START);
+    JiffyPair(data, 0b00010000, 0b00100000);  // bits 4,5
+    IecHal::DelayMicros(TIME_JIFFY_PAIR1);
+    JiffyPair(data, 0b01000000, 0b10000000);  // bits 6,7
+    IecHal::DelayMicros(TIME_JIFFY_PAIR2);
+    JiffyPair(data, 0b00001000, 0b00000010);  // bits 3,1
+    IecHal::DelayMicros(TIME_JIFFY_PAIR3);
+    JiffyPair(data, 0b00000100, 0b00000001);  // bits 2,0
+    IecHal::DelayMicros(TIME_JIFFY_PAIR4);
+    // EOI flag on CLK, DIO released for listener acknowledge
+    Release(dioBit);
+    if (eoi) {
+      Release(clkBit);
+    } else {
+      Assert(clkBit);
+    }
+    IecHal::DelayMicros(TIME_JIFFY_EOI);
+    Assert(clkBit);
+  }
+}
+
+/// Announce a fast serial host under ATN when requested by Listen().
+/// The listener is verified as fast serial capable on first data byte.
+template<class Port>
+void IecSerialBase<Port>::AnnounceBurst() {
+  if (!m_burstProbe) {
+    return;
+  }
+  m_burstProbe = false;
+  SendBurstBits(0xFF);
+  if (m_fastMode == FAST_NONE) {
+    m_fastMode = FAST_BURST;  // JiffyDOS takes precedence when detected
+  }
+}
+
+/// Clock a byte on DIO with SRQ, MSB first, no handshake.
+/// @param data  is the byte to send
+/// @note DIO line is released on exit
+template<class Port>
+void IecSerialBase<Port>::SendBurstBits(uint8_t data) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      Assert(srqBit);
+      if (data & 0x80) {
+        Release(dioBit);  // bit=1 -> Release DIO (high)
+      } else {
+        Assert(dioBit);  // bit=0 -> Assert DIO (low)
+      }
+      data <<= 1;  // Move bits left for next iteration
+      IecHal::DelayMicros(TIME_BURST_HALF);
+      Release(srqBit);  // bit valid
+      IecHal::DelayMicros(TIME_BURST_HALF);
+    }
+    Release(dioBit);
+  }
+}
+
+/// Receive a byte from current Talking device with handshake.
+/// @param data  is the received byte
+/// @param eoi returns true if the talker signaled EOI with the byte
+/// @return true if OK, false if error
+// on entering and exiting: DIO asserted by controller, CLK asserted by talker
+template<class Port>
+bool IecSerialBase<Port>::Receive(uint8_t& data, bool& eoi) {
+  eoi = false;
+  // Wait Talker Ready to Send
+  if (WaitReleaseOrTimeout(clkBit, TIME_TALKER_READY)) {
+    m_status = STATUS_TALKER_TIMEOUT;
+    return false;
+  }
+  Release(dioBit);  // Listener Ready for Data
+  // Talker starts the bit stream, or signals EOI by holding CLK released
+  if (WaitAssertionOrTimeout(clkBit, TIME_EOI_DETECT)) {
+    eoi = true;
+    m_status = STATUS_OK;
+    Assert(dioBit);  // EOI acknowledge
+    IecHal::DelayMicros(TIME_TEI_HOLD);
+    Release(dioBit);
+  }
+  if (!GetBits(data)) {
+    Assert(dioBit);
+    return false;
+  }
+  // Talker asserts CLK at end of frame, Data Accepted
+  if (WaitAssertionOrTimeout(clkBit, TIME_TALKER_BIT)) {
+    m_status = STATUS_TALKER_TIMEOUT;
+    Assert(dioBit);
+    return false;
+  }
+  Assert(dioBit);
+  return true;
+}
+
+/// Receive a byte from device, no handshake, LSB first.
+/// @param data  is the received byte
+/// @return true if OK, false if talker stopped clocking bits
+template<class Port>
+bool IecSerialBase<Port>::GetBits(uint8_t& data) {
+  data = 0;   // All bits zero
+  for (uint8_t bit = 0; bit < 8; bit++) {
+    data >>= 1;  // receving LSB first then move to right on each iteration
+    // Wait TALKER prepare the bit, then read bit at CLK release
+    if (WaitAssertionOrTimeout(clkBit, TIME_TALKER_BIT) ||
+        WaitReleaseOrTimeout(clkBit, TIME_TALKER_BIT)) {
+      m_status = STATUS_TALKER_TIMEOUT;
+      return false;
+    }
+    if (isReleased(dioBit)) {  // DIO released: bit=1
+      data |= 0b10000000;  // set bit 7
+    }
+  }
+  return true;
+}
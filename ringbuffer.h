@@ -0,0 +1,164 @@
+/**************************************************************
+ * ringbuffer.h
+ * RingBuffer class declaration and implementation
+ * A single producer / single consumer circular byte queue
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#if defined(__AVR__) || defined(IEC_HOST)
+#include <util/atomic.h>
+#else
+#include "iechal.h"  // ATOMIC_BLOCK
+#endif
+
+/**************************************************************
+ * The producer (usually an interrupt service routine) only moves
+ * the head index and the consumer (main loop) only moves the tail
+ * index, so no locking is needed for Put() and Get() themselves.
+ * Indexes are 16 bit wide, so the consumer side reads the head and
+ * writes the tail with interrupts masked to avoid torn accesses on
+ * 8 bit CPUs.
+ *
+ * PutAt() and Commit() let the producer write a block ahead of
+ * the head and queue it only once the whole block is validated.
+ * Span() and Consume() let the consumer parse queued data in place
+ * instead of copying it out byte by byte.
+ *
+ * Storage size must be a power of two. One slot is kept free to
+ * tell a full queue from an empty one.
+ **************************************************************/
+
+/// Circular byte queue over a caller supplied storage array
+class RingBuffer {
+public:
+  /// Constructor.
+  /// @param storage is the byte array holding queued data
+  /// @param size is the storage size in bytes, must be a power of two
+  RingBuffer(uint8_t storage[], size_t size)
+            : m_data(storage), m_mask(size - 1), m_head(0), m_tail(0) {};
+
+  /// Queue a byte. Producer side.
+  /// @param c is the byte to queue
+  /// @return true if ok, false if queue is full and byte was discarded
+  inline bool Put(uint8_t c) __attribute__((always_inline)) {
+    uint16_t next = (m_head + 1) & m_mask;
+    if (next == m_tail) {
+      return false;  // full
+    }
+    m_data[m_head] = c;
+    m_head = next;
+    return true;
+  };
+
+  /// Write a byte past the queue head without queuing it yet. Producer side.
+  /// @param offset is the byte position counted from the head
+  /// @param c is the byte to write
+  /// @return true if ok, false if queue has no room for it
+  inline bool PutAt(size_t offset, uint8_t c) __attribute__((always_inline)) {
+    if (CountFromProducer() + offset >= m_mask) {
+      return false;  // full
+    }
+    m_data[(m_head + offset) & m_mask] = c;
+    return true;
+  };
+
+  /// Queue bytes previously written with PutAt(). Producer side.
+  /// @param n is the number of bytes to queue
+  inline void Commit(size_t n) __attribute__((always_inline)) {
+    m_head = (m_head + n) & m_mask;
+  };
+
+  /// Remove and return the oldest byte. Consumer side.
+  /// @return the oldest queued byte. Queue must not be empty.
+  inline uint8_t Get() __attribute__((always_inline)) {
+    uint8_t c = m_data[m_tail];
+    uint16_t next = (m_tail + 1) & m_mask;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      m_tail = next;  // producer reads it from interrupt context
+    }
+    return c;
+  };
+
+  /// Return a queued byte without removing it. Consumer side.
+  /// @param offset is the byte position counted from the oldest one
+  /// @return the queued byte. Queue must hold more than offset bytes.
+  inline uint8_t Peek(size_t offset = 0) __attribute__((always_inline)) {
+    return m_data[(m_tail + offset) & m_mask];
+  };
+
+  /// Contiguous run of queued bytes, read in place. Consumer side.
+  /// @param data returns a pointer to the oldest queued byte
+  /// @return run length, up to the storage end. Zero if queue is empty.
+  size_t Span(const uint8_t*& data) {
+    size_t count = Count();
+    size_t toEnd = m_mask + 1 - m_tail;
+    data = &m_data[m_tail];
+    return (count < toEnd) ? count : toEnd;
+  };
+
+  /// Remove bytes already read in place. Consumer side.
+  /// @param n is the number of bytes to remove, up to the queue count
+  void Consume(size_t n) {
+    uint16_t next = (m_tail + n) & m_mask;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      m_tail = next;
+    }
+  };
+
+  /// Number of queued bytes
+  size_t Count() {
+    uint16_t head;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      head = m_head;
+    }
+    return (head - m_tail) & m_mask;
+  };
+
+  /// Number of bytes that can still be queued
+  size_t Free() { return m_mask - Count(); };
+
+  /// Storage capacity in bytes
+  size_t Capacity() { return m_mask; };
+
+  bool isEmpty() { return (Count() == 0); };
+
+  /// Discard all queued data. Consumer side.
+  void Clear() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      m_tail = m_head;
+    }
+  };
+
+  /// Producer side queue count, to be used from the producer context
+  inline size_t CountFromProducer() __attribute__((always_inline)) {
+    return (m_head - m_tail) & m_mask;
+  };
+
+private:
+  uint8_t* m_data;          // Queue storage
+  const uint16_t m_mask;    // Storage size - 1
+  volatile uint16_t m_head; // Next write position (producer)
+  volatile uint16_t m_tail; // Next read position (consumer)
+};
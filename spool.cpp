@@ -0,0 +1,177 @@
+/**************************************************************
+ * spool.cpp
+ * Spool classes implementation
+ * External storage FIFO backends for large print jobs
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#include "spool.h"
+
+//-----------------------------------------------
+// SPI SRAM spool
+//-----------------------------------------------
+
+/// Initialize SPI and set SRAM to sequential mode
+/// @return true if SRAM found, false if not
+bool SramSpool::Begin() {
+  pinMode(m_cs, OUTPUT);
+  digitalWrite(m_cs, HIGH);
+  SPI.begin();
+  // Set sequential mode
+  SPI.beginTransaction(SPISettings(SRAM_CLOCK, MSBFIRST, SPI_MODE0));
+  digitalWrite(m_cs, LOW);
+  SPI.transfer(SRAM_WRMR);
+  SPI.transfer(SRAM_SEQUENTIAL);
+  Deselect();
+  // Read mode back to detect the chip
+  SPI.beginTransaction(SPISettings(SRAM_CLOCK, MSBFIRST, SPI_MODE0));
+  digitalWrite(m_cs, LOW);
+  SPI.transfer(SRAM_RDMR);
+  uint8_t mode = SPI.transfer(0xFF);
+  Deselect();
+  Clear();
+  return (mode == SRAM_SEQUENTIAL);
+}
+
+/// Append data to spool
+/// @param data[] is the data to append
+/// @param length is the data length
+/// @return number of bytes appended, limited by free space
+size_t SramSpool::Write(const uint8_t data[], size_t length) {
+  if (length > Free()) {
+    length = Free();
+  }
+  if (length == 0) {
+    return 0;
+  }
+  Select(SRAM_WRITE, m_head);
+  for (size_t i = 0; i < length; i++) {
+    SPI.transfer(data[i]);
+  }
+  Deselect();
+  m_head = (m_head + length) & (SRAM_SIZE - 1);
+  m_count += length;
+  return length;
+}
+
+/// Consume data from spool
+/// @param data[] receives the data read
+/// @param length is the max number of bytes to read
+/// @return number of bytes read, limited by spooled data
+size_t SramSpool::Read(uint8_t data[], size_t length) {
+  if (length > m_count) {
+    length = m_count;
+  }
+  if (length == 0) {
+    return 0;
+  }
+  Select(SRAM_READ, m_tail);
+  for (size_t i = 0; i < length; i++) {
+    data[i] = SPI.transfer(0xFF);
+  }
+  Deselect();
+  m_tail = (m_tail + length) & (SRAM_SIZE - 1);
+  m_count -= length;
+  return length;
+}
+
+/// Start a SRAM sequential access
+/// @param cmd is the read or write instruction
+/// @param address is the start address
+void SramSpool::Select(uint8_t cmd, uint32_t address) {
+  SPI.beginTransaction(SPISettings(SRAM_CLOCK, MSBFIRST, SPI_MODE0));
+  digitalWrite(m_cs, LOW);
+  SPI.transfer(cmd);
+  SPI.transfer(address >> 16);
+  SPI.transfer(address >> 8);
+  SPI.transfer(address);
+}
+
+/// End a SRAM access
+void SramSpool::Deselect() {
+  digitalWrite(m_cs, HIGH);
+  SPI.endTransaction();
+}
+
+//-----------------------------------------------
+// SD card spool
+//-----------------------------------------------
+
+static const char SpoolFile[] = "SPOOL.BIN";  ///< Spool file name
+
+/// Initialize SD card and create an empty spool file
+/// @return true if OK, false if card or file not available
+bool SdSpool::Begin() {
+  if (!SD.begin(m_cs)) {
+    return false;
+  }
+  Clear();
+  return (bool)m_file;
+}
+
+/// Append data to spool file
+/// @param data[] is the data to append
+/// @param length is the data length
+/// @return number of bytes appended
+size_t SdSpool::Write(const uint8_t data[], size_t length) {
+  if (!m_file) {
+    return 0;
+  }
+  m_file.seek(m_readPos + m_count);
+  length = m_file.write(data, length);
+  m_count += length;
+  return length;
+}
+
+/// Consume data from spool file
+/// @param data[] receives the data read
+/// @param length is the max number of bytes to read
+/// @return number of bytes read, limited by spooled data
+size_t SdSpool::Read(uint8_t data[], size_t length) {
+  if (length > m_count) {
+    length = m_count;
+  }
+  if (length == 0) {
+    return 0;
+  }
+  m_file.seek(m_readPos);
+  int n = m_file.read(data, length);
+  if (n <= 0) {
+    return 0;
+  }
+  m_readPos += n;
+  m_count -= n;
+  if (m_count == 0) {
+    Clear();  // drained, start over from an empty file
+  }
+  return n;
+}
+
+/// Discard spooled data and truncate the spool file
+void SdSpool::Clear() {
+  if (m_file) {
+    m_file.close();
+  }
+  SD.remove(SpoolFile);
+  m_file = SD.open(SpoolFile, O_READ | O_WRITE | O_CREAT);
+  m_readPos = 0;
+  m_count = 0;
+}
@@ -0,0 +1,118 @@
+/**************************************************************
+ * spool.h
+ * Spool class declarations
+ * External storage FIFO backends for large print jobs
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <SPI.h>
+#include <SD.h>
+
+/**************************************************************
+ * A spool is a streaming FIFO on external storage. The main loop
+ * moves received data from the serial input queue to the spool and
+ * the printer side reads it back, so a whole job can be received at
+ * full link rate while the printer drains it at its own pace.
+ *
+ * Write() appends at the head and Read() consumes at the tail, both
+ * in constant time regardless of the amount of spooled data:
+ *   SramSpool : 23LC1024 128K byte SPI SRAM used as a circular buffer.
+ *               Sequential mode wraps the address at the array end.
+ *   SdSpool   : SD card file. Data is appended at the file end and
+ *               read from a running position. The file is truncated
+ *               each time the spool runs empty.
+ *
+ * SPI SCK is Arduino pin 13, shared with the on-board LED.
+ **************************************************************/
+
+/// Streaming FIFO on external storage
+class Spool {
+public:
+  Spool() : m_count(0) {};
+
+  virtual bool Begin() = 0;
+  virtual size_t Write(const uint8_t data[], size_t length) = 0;
+  virtual size_t Read(uint8_t data[], size_t length) = 0;
+  virtual void Clear() = 0;
+  virtual uint32_t Capacity() = 0;
+
+  /// Number of spooled bytes
+  uint32_t Count() { return m_count; };
+  /// Number of bytes that can still be spooled
+  uint32_t Free() { return Capacity() - m_count; };
+  bool isEmpty() { return (m_count == 0); };
+
+protected:
+  uint32_t m_count;  // Spooled bytes
+};
+
+/// Spool on a 23LC1024 SPI SRAM
+class SramSpool : public Spool {
+public:
+  SramSpool(uint8_t csPin) : m_cs(csPin), m_head(0), m_tail(0) {};
+
+  virtual bool Begin();
+  virtual size_t Write(const uint8_t data[], size_t length);
+  virtual size_t Read(uint8_t data[], size_t length);
+  virtual void Clear() { m_head = m_tail = 0; m_count = 0; };
+  virtual uint32_t Capacity() { return SRAM_SIZE; };
+
+private:
+  void Select(uint8_t cmd, uint32_t address);
+  void Deselect();
+
+private:
+  static constexpr uint32_t SRAM_SIZE = 131072;  // 23LC1024 array size
+  // 23LC1024 instructions
+  static constexpr uint8_t SRAM_READ  = 0x03;
+  static constexpr uint8_t SRAM_WRITE = 0x02;
+  static constexpr uint8_t SRAM_RDMR  = 0x05;  // Read Mode Register
+  static constexpr uint8_t SRAM_WRMR  = 0x01;  // Write Mode Register
+  static constexpr uint8_t SRAM_SEQUENTIAL = 0x40;  // Sequential mode
+  static constexpr uint32_t SRAM_CLOCK = 8000000;  // SPI clock [Hz]
+
+  uint8_t m_cs;       // Chip select pin
+  uint32_t m_head;    // Next write address
+  uint32_t m_tail;    // Next read address
+};
+
+/// Spool on a SD card file
+class SdSpool : public Spool {
+public:
+  SdSpool(uint8_t csPin) : m_cs(csPin), m_readPos(0) {};
+
+  virtual bool Begin();
+  virtual size_t Write(const uint8_t data[], size_t length);
+  virtual size_t Read(uint8_t data[], size_t length);
+  virtual void Clear();
+  virtual uint32_t Capacity() { return SD_LIMIT; };
+
+private:
+  static constexpr uint32_t SD_LIMIT = 0x7FFFFFFF;     // Max spool file size
+
+  uint8_t m_cs;        // Chip select pin
+  File m_file;         // Spool file
+  uint32_t m_readPos;  // Next read position in file
+};
@@ -0,0 +1,493 @@
+/**************************************************************
+ * usbserial.cpp
+ * UsbSerial class implementation
+ * Interrupt driven USART0 driver for the USB host link
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#include "usbserial.h"
+#if defined(__AVR__) || defined(IEC_HOST)
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+#else
+#include "iechal.h"  // ATOMIC_BLOCK
+
+/// CRC-16/CCITT-FALSE update, as avr-libc _crc_xmodem_update()
+static uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data) {
+  crc ^= (uint16_t)data << 8;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+#endif
+
+UsbSerial* UsbSerial::s_instance = 0;
+
+/// Standard rates selected by auto-baud
+static const unsigned long StandardRates[] = {
+  9600, 19200, 38400, 57600, 115200, 230400, 250000, 500000, 1000000
+};
+
+/// Sync frame: STX, seq 0, no payload, CRC-16/CCITT-FALSE
+static const uint8_t SyncFrame[] = { UsbSerial::STX, 0x00, 0x00, 0x1D, 0x0F };
+
+/// Constructor.
+/// @param rxStorage[] is the receive queue storage array
+/// @param rxSize is the receive queue storage size, must be a power of two
+UsbSerial::UsbSerial(uint8_t rxStorage[], size_t rxSize)
+          : m_rx(rxStorage, rxSize), m_lastRx(0), m_lastByte(0), m_overruns(0),
+            m_flow(FLOW_NONE), m_ctsPin(0), m_stopped(false),
+            m_break(false), m_baudrate(0),
+            m_framed(false), m_syncIndex(0), m_frameState(FRAME_STX),
+            m_expected(1), m_reply(0), m_lastCredit(0), m_replyTime(0) {
+  // Stop at 3/4 full leaving room for bytes already in flight from host
+  m_highWater = (rxSize / 4) * 3;
+  m_lowWater = rxSize / 4;
+}
+
+/// Configure USART0 for 8N1 and enable the receive interrupt,
+/// or start the core Serial object on other boards
+/// @param baudrate is the serial link speed in bauds
+void UsbSerial::Begin(unsigned long baudrate) {
+  s_instance = this;
+  m_baudrate = baudrate;
+#ifndef USBSERIAL_USART0
+#ifdef ARDUINO_ARCH_ESP32
+  Serial.setRxBufferSize(Capacity());  // hold data while the main loop is on the bus
+#endif
+  Serial.begin(baudrate);
+#else
+  // Nearest divisors in normal (16 samples per bit) and double speed mode
+  uint16_t ubrr = (F_CPU / 8 / baudrate + 1) / 2 - 1;
+  uint16_t ubrr2x = (F_CPU / 4 / baudrate + 1) / 2 - 1;
+  uint8_t mode = 0;
+  if (RateError(baudrate, 8, ubrr2x) < RateError(baudrate, 16, ubrr)) {
+    ubrr = ubrr2x;
+    mode = _BV(U2X0);
+  }
+  UCSR0B = 0;
+  UCSR0A = mode;
+  UBRR0H = ubrr >> 8;
+  UBRR0L = ubrr;
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);  // 8 data bits, no parity, 1 stop bit
+  UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+#endif
+}
+
+/// Link speed error of a divisor setting
+/// @param baudrate is the wanted speed
+/// @param divider is 16 for normal mode, 8 for double speed mode
+/// @param ubrr is the baud rate register value
+/// @return absolute error in bauds
+unsigned long UsbSerial::RateError(unsigned long baudrate, uint8_t divider, uint16_t ubrr) {
+  unsigned long actual = F_CPU / divider / (ubrr + 1UL);
+  return (actual > baudrate) ? actual - baudrate : baudrate - actual;
+}
+
+/// Check a speed against the standard rates auto-baud selects
+/// @param baudrate is the speed in bauds
+/// @return true if baudrate is one of the standard rates
+bool UsbSerial::isStandardRate(unsigned long baudrate) {
+  for (uint8_t i = 0; i < sizeof(StandardRates) / sizeof(StandardRates[0]); i++) {
+    if (StandardRates[i] == baudrate) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Detect host link speed from a character sent by the host, 'U' is best.
+/// Measures the shortest pulse on RX with Timer1 at clk/8, the same
+/// setting used by the IEC transmit engine, so it must not be running.
+/// @param timeout is the max time waiting for the first character [ms]
+/// @return true if a standard rate was detected and set, false if not
+bool UsbSerial::AutoBaud(unsigned long timeout) {
+#ifndef USBSERIAL_USART0
+  return false;  // Serial object link, rate set by Begin() or by USB
+#else
+  UCSR0B &= ~(_BV(RXEN0) | _BV(RXCIE0));  // RX pin read as input
+  TCCR1A = 0;           // Timer1 normal mode
+  TCCR1B = _BV(CS11);   // clk/8
+  // Wait start bit of first character
+  unsigned long start = millis();
+  while (bit_is_set(PIND, PD0)) {
+    if (millis() - start >= timeout) {
+      UCSR0B |= _BV(RXEN0) | _BV(RXCIE0);
+      return false;
+    }
+  }
+  // Time pulses of this character with interrupts masked
+  uint16_t shortest = 0xFFFF;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint16_t last = TCNT1;
+    uint8_t level = 0;
+    TIFR1 = _BV(TOV1);
+    for (uint8_t edges = 0; edges < AUTOBAUD_EDGES; edges++) {
+      // Wait next edge, up to a Timer1 overflow (32ms)
+      while ((PIND & _BV(PD0)) == level) {
+        if (bit_is_set(TIFR1, TOV1)) {
+          break;
+        }
+      }
+      uint16_t now = TCNT1;
+      if (bit_is_set(TIFR1, TOV1)) {
+        break;  // line idle, end of character
+      }
+      // First pulse skipped, its start was seen late
+      if (edges > 0 && (uint16_t)(now - last) < shortest) {
+        shortest = now - last;
+      }
+      last = now;
+      level ^= _BV(PD0);
+    }
+  }
+  // Wait line idle, then pick the nearest standard rate.
+  // RX stays off meanwhile, so the character is not queued.
+  delay(10);
+  bool ok = (shortest != 0xFFFF && shortest > 0);
+  if (ok) {
+    unsigned long measured = F_CPU / 8 / shortest;
+    unsigned long best = StandardRates[0];
+    for (uint8_t i = 1; i < sizeof(StandardRates) / sizeof(StandardRates[0]); i++) {
+      unsigned long rate = StandardRates[i];
+      // Compare ratios: rate/measured against measured/best
+      if ((unsigned long long)rate * best < (unsigned long long)measured * measured) {
+        best = rate;
+      }
+    }
+    Begin(best);
+  } else {
+    UCSR0B |= _BV(RXEN0) | _BV(RXCIE0);
+  }
+  m_break = false;
+  return ok;
+#endif
+}
+
+/// Select receive flow control mode
+/// @param mode is FLOW_NONE, FLOW_XONXOFF or FLOW_RTSCTS
+/// @param ctsPin is the CTS output pin used by FLOW_RTSCTS
+void UsbSerial::SetFlowControl(uint8_t mode, uint8_t ctsPin) {
+  if (mode == m_flow && ctsPin == m_ctsPin) {
+    return;  // no change
+  }
+  // Let the host go with the current mode before switching
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    ResumeSender();
+    m_flow = mode;
+    m_ctsPin = ctsPin;
+  }
+  if (mode == FLOW_RTSCTS) {
+    pinMode(ctsPin, OUTPUT);
+    digitalWrite(ctsPin, LOW);  // clear to send
+  }
+  // Stop the host right away if the queue is already filled up
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (m_rx.CountFromProducer() >= m_highWater) {
+      StopSender();
+    }
+  }
+}
+
+/// Time since the last received byte
+/// @return elapsed time in milliseconds
+unsigned long UsbSerial::Idle() {
+  unsigned long lastRx;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    lastRx = m_lastRx;
+  }
+  return millis() - lastRx;
+}
+
+/// Number of received bytes discarded because the queue was full
+uint16_t UsbSerial::Overruns() {
+  uint16_t overruns;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    overruns = m_overruns;
+  }
+  return overruns;
+}
+
+/// Send pending framed mode replies and window updates to host.
+/// To be called from the main loop.
+void UsbSerial::Service() {
+  Poll();
+  uint8_t reply;
+  uint8_t seq;
+  uint8_t credit;
+  bool framed;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    reply = m_reply;
+    m_reply = 0;
+    seq = (reply == NAK) ? m_expected : PrevSeq(m_expected);
+    credit = Credit();
+    framed = m_framed;
+  }
+  if (reply == 0 && framed && m_lastCredit == 0 && credit > 0) {
+    reply = ACK;  // window update, queue drained
+  }
+  if (reply != 0) {
+    write(reply);
+    write(seq);
+    write(credit);
+    m_lastCredit = credit;
+    m_replyTime = millis();
+  }
+  // Back to raw mode if host went away. Without credit the host is silent by design
+  if (framed && credit > 0 && Idle() >= FRAME_TIMEOUT && millis() - m_replyTime >= FRAME_TIMEOUT) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      m_framed = false;
+      m_frameState = FRAME_STX;
+    }
+  }
+}
+
+/// Number of full frames the host may still send
+uint8_t UsbSerial::Credit() {
+  size_t frames = m_rx.Free() / FRAME_PAYLOAD;
+  if (frames > FRAME_WINDOW) {
+    frames = FRAME_WINDOW;
+  }
+  return frames;
+}
+
+/// Send a byte to host. Waits for the transmit register, no buffering.
+/// @param c is the byte to send
+/// @return number of bytes written
+size_t UsbSerial::write(uint8_t c) {
+#ifndef USBSERIAL_USART0
+  return Serial.write(c);
+#else
+  // Atomic check and write, the RX interrupt may inject XON/XOFF
+  for (;;) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      if (bit_is_set(UCSR0A, UDRE0)) {
+        UDR0 = c;
+        return 1;
+      }
+    }
+  }
+#endif
+}
+
+/// Send a flow control byte at once. Interrupts must be disabled.
+/// @param c is the byte to send
+void UsbSerial::SendNow(uint8_t c) {
+#ifndef USBSERIAL_USART0
+  Serial.write(c);
+#else
+  while (bit_is_clear(UCSR0A, UDRE0));
+  UDR0 = c;
+#endif
+}
+
+/// Resume host if queue drained below the low-water mark
+void UsbSerial::CheckResume() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (m_stopped && m_rx.CountFromProducer() <= m_lowWater) {
+      ResumeSender();
+    }
+  }
+}
+
+/// Ask host to stop sending. Interrupts must be disabled.
+void UsbSerial::StopSender() {
+  if (m_stopped || m_framed) {
+    return;  // framed mode host follows the credit
+  }
+  if (m_flow == FLOW_XONXOFF) {
+    SendNow(XOFF);
+    m_stopped = true;
+  } else if (m_flow == FLOW_RTSCTS) {
+    digitalWrite(m_ctsPin, HIGH);  // not clear to send
+    m_stopped = true;
+  }
+}
+
+/// Let host resume sending. Interrupts must be disabled.
+void UsbSerial::ResumeSender() {
+  if (!m_stopped) {
+    return;
+  }
+  if (m_flow == FLOW_XONXOFF) {
+    SendNow(XON);
+  } else if (m_flow == FLOW_RTSCTS) {
+    digitalWrite(m_ctsPin, LOW);  // clear to send
+  }
+  m_stopped = false;
+}
+
+/// Store a received byte in queue. Called from the RX interrupt.
+void UsbSerial::ReceiveIsr() {
+#ifdef USBSERIAL_USART0
+  bool framingError = bit_is_set(UCSR0A, FE0);
+  uint8_t c = UDR0;
+  if (framingError) {
+    m_lastRx = millis();
+    if (c == 0) {
+      // RX held low for a whole frame, stop receiving until auto-baud
+      m_break = true;
+      UCSR0B &= ~(_BV(RXEN0) | _BV(RXCIE0));
+    }
+    return;
+  }
+  Receive(c);
+#endif
+}
+
+#ifndef USBSERIAL_USART0
+/// Move bytes received by the core Serial object into the queue. Bytes
+/// that do not fit stay with the core, which holds the host off.
+void UsbSerial::Poll() {
+  while (m_rx.Free() > 0 && Serial.available() > 0) {
+    Receive(Serial.read());
+  }
+}
+#endif
+
+/// Take a received byte, raw data or framed mode
+/// @param c is the received byte
+void UsbSerial::Receive(uint8_t c) {
+  m_lastRx = millis();
+  if (m_framed) {
+    ReceiveFrame(c);
+  } else if ((m_syncIndex == 0 && c != STX) || !MatchSync(c)) {
+    Store(c);
+  }
+}
+
+/// Queue a raw mode byte
+void UsbSerial::Store(uint8_t c) {
+  if (!m_rx.Put(c)) {
+    m_overruns++;
+  }
+  m_lastByte = c;
+  // Stop host before the queue overflows
+  if (m_rx.CountFromProducer() >= m_highWater) {
+    StopSender();
+  }
+}
+
+/// Match the sync frame that starts framed mode. Held bytes are
+/// queued as raw data on a mismatch.
+/// @param c is the received byte
+/// @return true if byte was taken, false if it is raw data
+bool UsbSerial::MatchSync(uint8_t c) {
+  if (c == SyncFrame[m_syncIndex]) {
+    if (++m_syncIndex == SYNC_SIZE) {
+      // Host tool connected
+      ResumeSender();
+      m_syncIndex = 0;
+      m_framed = true;
+      m_frameState = FRAME_STX;
+      m_expected = 1;
+      m_reply = ACK;
+    }
+    return true;
+  }
+  for (uint8_t i = 0; i < m_syncIndex; i++) {
+    Store(SyncFrame[i]);
+  }
+  m_syncIndex = (c == STX) ? 1 : 0;
+  return (m_syncIndex != 0);
+}
+
+/// Framed mode receiver
+/// @param c is the received byte
+void UsbSerial::ReceiveFrame(uint8_t c) {
+  switch (m_frameState) {
+    case FRAME_STX:
+      if (c == STX) {
+        m_frameCrc = 0xFFFF;
+        m_frameState = FRAME_SEQ;
+      }
+      return;  // skip noise between frames
+    case FRAME_SEQ:
+      m_frameSeq = c;
+      m_frameState = FRAME_LEN;
+      break;
+    case FRAME_LEN:
+      if (c > FRAME_PAYLOAD) {
+        m_reply = NAK;  // corrupted length
+        m_frameState = FRAME_STX;
+        return;
+      }
+      m_frameLen = c;
+      m_frameCount = 0;
+      m_frameError = false;
+      m_frameState = (c > 0) ? FRAME_DATA : FRAME_CRC_HI;
+      break;
+    case FRAME_DATA:
+      // Write ahead of queue head, queued once the frame is checked
+      if (!m_rx.PutAt(m_frameCount, c)) {
+        m_frameError = true;
+      }
+      m_frameLast = c;
+      if (++m_frameCount == m_frameLen) {
+        m_frameState = FRAME_CRC_HI;
+      }
+      break;
+    case FRAME_CRC_HI:
+      m_frameRxCrc = c << 8;
+      m_frameState = FRAME_CRC_LO;
+      return;
+    case FRAME_CRC_LO:
+      m_frameRxCrc |= c;
+      m_frameState = FRAME_STX;
+      EndFrame();
+      return;
+  }
+  m_frameCrc = _crc_xmodem_update(m_frameCrc, c);
+}
+
+/// Check a complete frame and queue its payload
+void UsbSerial::EndFrame() {
+  if (m_frameCrc != m_frameRxCrc || m_frameError) {
+    m_reply = NAK;
+    return;
+  }
+  if (m_frameSeq == m_expected) {
+    m_rx.Commit(m_frameLen);
+    m_expected = NextSeq(m_expected);
+    m_reply = ACK;
+    if (m_frameLen == 0) {
+      m_framed = false;  // end of transfer
+    } else {
+      m_lastByte = m_frameLast;
+    }
+  } else if (m_frameSeq == 0 && m_frameLen == 0) {
+    m_expected = 1;  // host restarted
+    m_reply = ACK;
+  } else if (m_frameSeq == PrevSeq(m_expected)) {
+    m_reply = ACK;  // duplicate, already queued
+  } else {
+    m_reply = NAK;
+  }
+}
+
+#ifdef USBSERIAL_USART0
+/// USART0 receive complete interrupt
+ISR(USART_RX_vect) {
+  UsbSerial::s_instance->ReceiveIsr();
+}
+#endif
@@ -0,0 +1,202 @@
+/**************************************************************
+ * usbserial.h
+ * UsbSerial class declaration
+ * Interrupt driven USART0 driver for the USB host link
+ *
+ * AUTHOR:
+ * Created by Ricardo F. Lopes on 05/03/2024 and released under GPLv3.
+ *
+ * LICENSE:
+ * This file is part of IECprinter.
+ *
+ * IECprinter is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * IECprinter is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with IECprinter. If not, see <https://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#include "ringbuffer.h"
+
+/**************************************************************
+ * Replaces the Arduino core Serial object. The USART RX interrupt
+ * stores every incoming byte straight into the receive queue, so
+ * data keeps arriving while the main loop is busy on the IEC bus.
+ *
+ * Optional flow control stops the host when the queue passes the
+ * high-water mark and resumes it when the queue drains below the
+ * low-water mark:
+ *   FLOW_XONXOFF : sends XOFF (DC3) / XON (DC1) to the host
+ *   FLOW_RTSCTS  : drives a CTS output pin, low = clear to send
+ *
+ * Framed mode gives a host tool reliable transfers. It starts when
+ * the host sends the sync frame and ends with an empty frame:
+ *   host   : STX seq len payload[len] crc_hi crc_lo
+ *   device : ACK seq credit   frames up to seq are queued
+ *            NAK seq credit   resend from seq
+ * crc is CRC-16/CCITT-FALSE over seq, len and payload. Sequence
+ * numbers run from 1 to 255 and wrap to 1, the sync frame is seq 0
+ * with no payload. A frame payload is written ahead of the queue head
+ * and queued only if the frame is valid and in sequence. credit is how
+ * many more full frames fit in the queue after seq: the host keeps up
+ * to that many frames in flight. Replies are sent by Service() from
+ * the main loop, so credit grows as the printer drains the queue.
+ * Framed mode ends on FRAME_TIMEOUT host silence with credit granted:
+ * with no credit the host waits, however long the printer stalls.
+ *
+ * Begin() picks normal or double speed (U2X) mode, whichever gives
+ * the smallest rate error. AutoBaud() measures the shortest pulse of
+ * a character sent by the host, 'U' (0x55) being the best as all its
+ * pulses are one bit wide, and selects the nearest standard rate.
+ * A break (RX held low for a whole frame) stops the receiver and is
+ * flagged by isBreak(), the sketch then runs auto-baud again.
+ *
+ * The Arduino Serial object must NOT be used in the sketch: it owns
+ * the same USART interrupt vector.
+ *
+ * Boards without USART0 (ATmega32U4 native USB CDC, RP2040, ESP32)
+ * receive through the core Serial object instead: Poll() moves its
+ * bytes into the queue, from Available(), isEmpty() and Service().
+ * A USB CDC link is flow controlled by USB itself and has no line
+ * rate, so AutoBaud() and breaks do not apply there.
+ **************************************************************/
+
+#if defined(__AVR_ATmega328P__) || defined(IEC_HOST)
+#define USBSERIAL_USART0  ///< Own USART0 driver, else the core Serial object
+#endif
+
+/// USB host serial link with a receive queue filled by interrupt
+class UsbSerial : public Print {
+public:
+  UsbSerial(uint8_t rxStorage[], size_t rxSize);
+
+  void Begin(unsigned long baudrate);
+  bool AutoBaud(unsigned long timeout);
+  unsigned long Baudrate() { return m_baudrate; };
+  static bool isStandardRate(unsigned long baudrate);
+  bool isBreak() { return m_break; };
+  void SetFlowControl(uint8_t mode, uint8_t ctsPin = 0);
+  uint8_t FlowControl() { return m_flow; };
+
+  size_t Available() { Poll(); return m_rx.Count(); };
+  size_t Queued() { return m_rx.Count(); };  // no Poll(), safe with interrupts off
+  bool isEmpty() { Poll(); return m_rx.isEmpty(); };
+  uint8_t Read() {
+    uint8_t c = m_rx.Get();
+    if (m_stopped) {
+      CheckResume();
+    }
+    return c;
+  };
+  uint8_t Peek(size_t offset = 0) { return m_rx.Peek(offset); };
+  uint8_t LastByte() { return m_lastByte; };
+  size_t Span(const uint8_t*& data) { return m_rx.Span(data); };
+  void Consume(size_t n) {
+    m_rx.Consume(n);
+    if (m_stopped) {
+      CheckResume();
+    }
+  };
+  void Flush() { m_rx.Clear(); CheckResume(); };
+  size_t Capacity() { return m_rx.Capacity(); };
+
+  unsigned long Idle();
+  uint16_t Overruns();
+
+  void Service();
+  bool isFramed() { return m_framed; };
+
+  virtual size_t write(uint8_t c);
+  using Print::write;
+
+  void ReceiveIsr();
+#ifdef USBSERIAL_USART0
+  void Poll() {};
+#else
+  void Poll();
+#endif
+
+public:
+  // Flow control modes
+  static constexpr uint8_t FLOW_NONE    = 0;
+  static constexpr uint8_t FLOW_XONXOFF = 1;
+  static constexpr uint8_t FLOW_RTSCTS  = 2;
+  // Flow control characters
+  static constexpr uint8_t XON  = 0x11;  // DC1
+  static constexpr uint8_t XOFF = 0x13;  // DC3
+  // Framed mode characters
+  static constexpr uint8_t STX = 0x02;
+  static constexpr uint8_t ACK = 0x06;
+  static constexpr uint8_t NAK = 0x15;
+  // Framed mode limits
+  static constexpr uint8_t FRAME_PAYLOAD = 64;    // Max payload bytes in a frame
+  static constexpr uint8_t FRAME_WINDOW  = 8;     // Max credit granted to host
+  static constexpr unsigned long FRAME_TIMEOUT = 10000;  // Host silence [ms] after a reply with credit that ends framed mode
+  // Auto-baud
+  static constexpr uint8_t AUTOBAUD_EDGES = 9;    // Edges after the start bit of a 'U' character
+
+private:
+  void CheckResume();
+  void StopSender();
+  void ResumeSender();
+  void Receive(uint8_t c);
+  void Store(uint8_t c);
+  void SendNow(uint8_t c);
+  bool MatchSync(uint8_t c);
+  void ReceiveFrame(uint8_t c);
+  void EndFrame();
+  uint8_t Credit();
+  static unsigned long RateError(unsigned long baudrate, uint8_t divider, uint16_t ubrr);
+  static uint8_t NextSeq(uint8_t seq) { return (seq == 255) ? 1 : seq + 1; };
+  static uint8_t PrevSeq(uint8_t seq) { return (seq == 1) ? 255 : seq - 1; };
+
+  // Frame receiver states
+  static constexpr uint8_t FRAME_STX    = 0;  // Waiting frame start
+  static constexpr uint8_t FRAME_SEQ    = 1;  // Sequence number
+  static constexpr uint8_t FRAME_LEN    = 2;  // Payload length
+  static constexpr uint8_t FRAME_DATA   = 3;  // Payload bytes
+  static constexpr uint8_t FRAME_CRC_HI = 4;  // CRC high byte
+  static constexpr uint8_t FRAME_CRC_LO = 5;  // CRC low byte
+  static constexpr uint8_t SYNC_SIZE    = 5;  // Sync frame size
+
+private:
+  RingBuffer m_rx;                     // Receive queue
+  volatile unsigned long m_lastRx;     // millis() at last received byte
+  volatile uint8_t m_lastByte;         // Newest byte queued
+  volatile uint16_t m_overruns;        // Bytes lost on a full queue
+  uint16_t m_highWater;                // Queue count that stops the host
+  uint16_t m_lowWater;                 // Queue count that resumes the host
+  uint8_t m_flow;                      // Flow control mode
+  uint8_t m_ctsPin;                    // CTS output pin for FLOW_RTSCTS
+  volatile bool m_stopped;             // Host was asked to stop sending
+  volatile bool m_break;               // Break condition received
+  unsigned long m_baudrate;            // Current link speed
+  volatile bool m_framed;              // Framed mode active
+  uint8_t m_syncIndex;                 // Sync frame bytes matched
+  uint8_t m_frameState;                // Frame receiver state
+  uint8_t m_frameSeq;                  // Received frame sequence number
+  uint8_t m_frameLen;                  // Received frame payload length
+  uint8_t m_frameCount;                // Payload bytes received
+  uint8_t m_frameLast;                 // Last payload byte received
+  bool m_frameError;                   // Payload did not fit in queue
+  uint16_t m_frameCrc;                 // CRC computed over received frame
+  uint16_t m_frameRxCrc;               // CRC received in frame
+  volatile uint8_t m_expected;         // Next expected sequence number
+  volatile uint8_t m_reply;            // Pending reply: ACK, NAK or 0
+  uint8_t m_lastCredit;                // Credit sent in the last reply
+  unsigned long m_replyTime;           // millis() at the last reply
+
+public:
+  static UsbSerial* s_instance;  // Instance served by the RX interrupt
+};